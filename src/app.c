@@ -27,6 +27,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "feeds.h"
 #include "mimehooks.h"
 #include "gmcerts.h"
+#include "gmcache.h"
+#include "gmprefetch.h"
+#include "gmscheduler.h"
 #include "gmdocument.h"
 #include "gmutil.h"
 #include "history.h"
@@ -111,6 +114,9 @@ struct Impl_App {
     iString *    execPath;
     iMimeHooks * mimehooks;
     iGmCerts *   certs;
+    iGmScheduler *scheduler;
+    iGmCache *   cache;
+    iGmPrefetch *prefetch;
     iVisited *   visited;
     iBookmarks * bookmarks;
     iWindow *    window;
@@ -127,6 +133,10 @@ struct Impl_App {
     iBool        isLoadingPrefs;
     iStringList *launchCommands;
     iBool        isFinishedLaunching;
+    iBool        isCacheTrimPending;
+    iTime        launchTime;
+    double       stateLoadSeconds;
+    double       firstFrameSeconds; /* zero until the first frame has been drawn */
     iTime        lastDropTime; /* for detecting drops of multiple items */
     int          autoReloadTimer;
     iPeriodic    periodic;
@@ -210,6 +220,10 @@ static iString *serializePrefs_App_(const iApp *d) {
     appendFormat_String(str, "smoothscroll arg:%d\n", d->prefs.smoothScrolling);
     appendFormat_String(str, "imageloadscroll arg:%d\n", d->prefs.loadImageInsteadOfScrolling);
     appendFormat_String(str, "cachesize.set arg:%d\n", d->prefs.maxCacheSize);
+    appendFormat_String(str, "hibernate.set arg:%d\n", d->prefs.hibernateAfter);
+    appendFormat_String(str, "prefetch arg:%d\n", d->prefs.prefetchLinks);
+    appendFormat_String(str, "feeds.requests.set arg:%d host:%d\n", d->prefs.maxFeedRequests,
+                        d->prefs.maxFeedRequestsPerHost);
     appendFormat_String(str, "decodeurls arg:%d\n", d->prefs.decodeUserVisibleURLs);
     appendFormat_String(str, "linewidth.set arg:%d\n", d->prefs.lineWidth);
     /* TODO: Set up an array of booleans in Prefs and do these in a loop. */
@@ -445,7 +459,8 @@ static iBool loadState_App_(iApp *d) {
                 if (flags & current_DocumentStateFlag) {
                     current[rootIndex] = doc;
                 }
-                deserializeState_DocumentWidget(doc, stream_File(f));
+                deserializeState_DocumentWidget(doc, stream_File(f),
+                                                !(flags & current_DocumentStateFlag));
                 doc = NULL;
             }
             else {
@@ -469,8 +484,10 @@ static iBool loadState_App_(iApp *d) {
 
 static void saveState_App_(const iApp *d) {
     iUnused(d);
-    trimCache_App();
     iWindow *win = d->window;
+    iForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
+        storeCache_History(history_DocumentWidget(i.object));
+    }
     /* UI state is saved in binary because it is quite complex (e.g.,
        navigation history, cached content) and depends closely on the widget
        tree. The data is largely not reorderable and should not be modified
@@ -518,6 +535,8 @@ static void saveState_App_(const iApp *d) {
         fprintf(stderr, "[App] failed to save state: %s\n", strerror(errno));
     }
     iRelease(f);
+    /* The index is written last so it includes everything the state file refers to. */
+    save_GmCache(d->cache);
 }
 
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
@@ -534,6 +553,7 @@ static uint32_t checkAsleep_App_(uint32_t interval, void *param) {
 static uint32_t postAutoReloadCommand_App_(uint32_t interval, void *param) {
     iUnused(param);
     postCommand_Root(NULL, "document.autoreload");
+    postCommand_Root(NULL, "document.hibernate");
     return interval;
 }
 
@@ -614,6 +634,9 @@ static iBool hasCommandLineOpenableScheme_(const iRangecc uri) {
 }
 
 static void init_App_(iApp *d, int argc, char **argv) {
+    initCurrent_Time(&d->launchTime);
+    d->stateLoadSeconds  = 0.0;
+    d->firstFrameSeconds = 0.0;
     init_CommandLine(&d->args, argc, argv);
     /* Where was the app started from? We ask SDL first because the command line alone is
        not a reliable source of this information, particularly when it comes to different
@@ -721,6 +744,7 @@ static void init_App_(iApp *d, int argc, char **argv) {
     const iBool isFirstRun =
         !fileExistsCStr_FileInfo(cleanedPath_CStr(concatPath_CStr(dataDir_App_(), "prefs.cfg")));
     d->isFinishedLaunching = iFalse;
+    d->isCacheTrimPending  = iFalse;
     d->isLoadingPrefs      = iFalse;
     d->warmupFrames        = 0;
     d->launchCommands      = new_StringList();
@@ -750,6 +774,9 @@ static void init_App_(iApp *d, int argc, char **argv) {
     d->window    = NULL;
     d->mimehooks = new_MimeHooks();
     d->certs     = new_GmCerts(dataDir_App_());
+    d->scheduler = new_GmScheduler();
+    d->cache     = new_GmCache(concatPath_CStr(dataDir_App_(), "cache"));
+    d->prefetch  = new_GmPrefetch();
     d->visited   = new_Visited();
     d->bookmarks = new_Bookmarks();
     init_Periodic(&d->periodic);
@@ -783,8 +810,13 @@ static void init_App_(iApp *d, int argc, char **argv) {
     init_Feeds(dataDir_App_());
     /* Widget state init. */
     processEvents_App(postedEventsOnly_AppEventMode);
-    if (!loadState_App_(d)) {
-        postCommand_Root(NULL, "open url:about:help");
+    /* Restore the previous session. */ {
+        iTime loadStart;
+        initCurrent_Time(&loadStart);
+        if (!loadState_App_(d)) {
+            postCommand_Root(NULL, "open url:about:help");
+        }
+        d->stateLoadSeconds = elapsedSeconds_Time(&loadStart);
     }
     postCommand_Root(NULL, "~window.unfreeze");
     postCommand_Root(NULL, "font.reset");
@@ -834,6 +866,9 @@ static void deinit_App(iApp *d) {
     delete_MimeHooks(d->mimehooks);
     delete_Window(d->window);
     d->window = NULL;
+    delete_GmPrefetch(d->prefetch);
+    delete_GmScheduler(d->scheduler); /* after all requests are gone */
+    delete_GmCache(d->cache);
     deinit_CommandLine(&d->args);
     iRelease(d->launchCommands);
     delete_String(d->execPath);
@@ -941,42 +976,50 @@ const iString *debugInfo_App(void) {
     iConstForEach(StringList, j, d->launchCommands) {
         appendFormat_String(msg, "%s\n", cstr_String(j.value));
     }
+    appendFormat_String(msg, "## Startup\n");
+    appendFormat_String(msg, "* State loaded in: %.0f ms\n", 1000.0 * d->stateLoadSeconds);
+    appendFormat_String(msg, "* First frame after: %.0f ms\n", 1000.0 * d->firstFrameSeconds);
     appendFormat_String(msg, "## MIME hooks\n");
     append_String(msg, debugInfo_MimeHooks(d->mimehooks));
+    appendFormat_String(msg, "## Response cache\n");
+    append_String(msg, debugInfo_GmCache(d->cache));
+    appendFormat_String(msg, "## Request scheduler\n");
+    append_String(msg, debugInfo_GmScheduler(d->scheduler));
+    appendFormat_String(msg, "## Link prefetching\n");
+    append_String(msg, debugInfo_GmPrefetch(d->prefetch));
+    appendFormat_String(msg, "## Rendering\n");
+    appendFormat_String(msg, "* Previous frame: %u ms\n", d->window->frameDrawTime);
+    appendFormat_String(msg, "* Glyph draw calls: %zu\n", d->window->frameTextDrawCalls);
+    append_String(msg, debugInfo_Text());
     return msg;
 }
 
 static void clearCache_App_(void) {
     iForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
+        hibernate_DocumentWidget(i.object); /* before its cached source is dropped */
         clearCache_History(history_DocumentWidget(i.object));
     }
 }
 
+static void trimCacheNow_App_(iApp *d) {
+    d->isCacheTrimPending = iFalse;
+    iPtrArray histories;
+    init_PtrArray(&histories);
+    iConstForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
+        pushBack_PtrArray(&histories, history_DocumentWidget(i.object));
+    }
+    trimCaches_History(&histories, (size_t) d->prefs.maxCacheSize * 1000000);
+    deinit_PtrArray(&histories);
+}
+
 void trimCache_App(void) {
+    /* Trimming is done when the app gets around to it, not in the middle of the caller's
+       work. Multiple requests are coalesced. */
     iApp *d = &app_;
-    size_t cacheSize = 0;
-    const size_t limit = d->prefs.maxCacheSize * 1000000;
-    iObjectList *docs = listDocuments_App(NULL);
-    iForEach(ObjectList, i, docs) {
-        cacheSize += cacheSize_History(history_DocumentWidget(i.object));
+    if (!d->isCacheTrimPending) {
+        d->isCacheTrimPending = iTrue;
+        postCommand_App("cache.trim");
     }
-    init_ObjectListIterator(&i, docs);
-    iBool wasPruned = iFalse;
-    while (cacheSize > limit) {
-        iDocumentWidget *doc = i.object;
-        const size_t pruned = pruneLeastImportant_History(history_DocumentWidget(doc));
-        if (pruned) {
-            cacheSize -= pruned;
-            wasPruned = iTrue;
-        }
-        next_ObjectListIterator(&i);
-        if (!i.value) {
-            if (!wasPruned) break;
-            wasPruned = iFalse;
-            init_ObjectListIterator(&i, docs);
-        }
-    }
-    iRelease(docs);
 }
 
 iLocalDef iBool isWaitingAllowed_App_(iApp *d) {
@@ -1288,6 +1331,9 @@ void refresh_App(void) {
 //    iTime draw;
 //    initCurrent_Time(&draw);
     draw_Window(d->window);
+    if (d->firstFrameSeconds == 0.0) {
+        d->firstFrameSeconds = elapsedSeconds_Time(&d->launchTime);
+    }
 //    printf("draw: %lld \u03bcs\n", (long long) (elapsedSeconds_Time(&draw) * 1000000));
 //    fflush(stdout);
     if (d->warmupFrames > 0) {
@@ -1485,6 +1531,18 @@ iGmCerts *certs_App(void) {
     return app_.certs;
 }
 
+iGmScheduler *scheduler_App(void) {
+    return app_.scheduler;
+}
+
+iGmCache *cache_App(void) {
+    return app_.cache;
+}
+
+iGmPrefetch *prefetch_App(void) {
+    return app_.prefetch;
+}
+
 iVisited *visited_App(void) {
     return app_.visited;
 }
@@ -1895,6 +1953,11 @@ iBool handleCommand_App(const char *cmd) {
         resetFonts_Text();
         return iTrue;
     }
+    else if (equal_Command(cmd, "text.glyphs.ready")) {
+        uploadGlyphs_Text();
+        postRefresh_App();
+        return iTrue;
+    }
     else if (equal_Command(cmd, "font.user")) {
         const char *path = suffixPtr_Command(cmd, "path");
         if (cmp_String(&d->prefs.symbolFontPath, path)) {
@@ -2120,11 +2183,32 @@ iBool handleCommand_App(const char *cmd) {
         }
         return iTrue;
     }
+    else if (equal_Command(cmd, "cache.trim")) {
+        trimCacheNow_App_(d);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "cachesize.set")) {
         d->prefs.maxCacheSize = arg_Command(cmd);
         if (d->prefs.maxCacheSize <= 0) {
             d->prefs.maxCacheSize = 0;
         }
+        setMaxSize_GmCache(d->cache, (size_t) d->prefs.maxCacheSize * 1000000);
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "feeds.requests.set")) {
+        d->prefs.maxFeedRequests        = iMax(1, arg_Command(cmd));
+        d->prefs.maxFeedRequestsPerHost = iMax(1, argLabel_Command(cmd, "host"));
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "prefetch")) {
+        d->prefs.prefetchLinks = arg_Command(cmd) != 0;
+        if (!d->prefs.prefetchLinks) {
+            cancel_GmPrefetch(d->prefetch, NULL);
+        }
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "hibernate.set")) {
+        d->prefs.hibernateAfter = iMax(0, arg_Command(cmd));
         return iTrue;
     }
     else if (equal_Command(cmd, "searchurl")) {
@@ -2478,6 +2562,14 @@ iBool handleCommand_App(const char *cmd) {
         fetchRemote_Bookmarks(bookmarks_App());
         return iTrue;
     }
+    else if (equal_Command(cmd, "prefetch.updated")) {
+        requestUpdated_GmPrefetch(d->prefetch, argU32Label_Command(cmd, "reqid"));
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "prefetch.finished")) {
+        requestFinished_GmPrefetch(d->prefetch, argU32Label_Command(cmd, "reqid"));
+        return iTrue;
+    }
     else if (equal_Command(cmd, "bookmarks.request.finished")) {
         requestFinished_Bookmarks(bookmarks_App(), pointerLabel_Command(cmd, "req"));
         return iTrue;
@@ -35,6 +35,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 iDeclareType(Bookmarks)
 iDeclareType(DocumentWidget)
 iDeclareType(GmCerts)
+iDeclareType(GmCache)
+iDeclareType(GmScheduler)
+iDeclareType(GmPrefetch)
 iDeclareType(MimeHooks)
 iDeclareType(Periodic)
 iDeclareType(Root)
@@ -87,6 +90,9 @@ iBool               isLandscape_App     (void);
 iLocalDef iBool     isPortrait_App      (void) { return !isLandscape_App(); }
 enum iAppDeviceType deviceType_App      (void);
 iGmCerts *          certs_App           (void);
+iGmScheduler *      scheduler_App       (void);
+iGmCache *          cache_App           (void);
+iGmPrefetch *       prefetch_App        (void);
 iVisited *          visited_App         (void);
 iBookmarks *        bookmarks_App       (void);
 iMimeHooks *        mimeHooks_App       (void);
@@ -695,17 +695,14 @@ void updateSourceData_Player(iPlayer *d, const iString *mimeType, const iBlock *
             set_Block(&input->data, data);
             input->isComplete = iFalse;
             break;
-        case append_PlayerUpdate: {
-            const size_t oldSize = size_Block(&input->data);
-            const size_t newSize = size_Block(data);
+        case append_PlayerUpdate:
+            /* Only the newly received data is given. */
             if (input->isComplete) {
-                iAssert(newSize == oldSize);
+                iAssert(isEmpty_Block(data));
                 break;
             }
-            /* The old parts cannot have changed. */
-            appendData_Block(&input->data, constBegin_Block(data) + oldSize, newSize - oldSize);
+            append_Block(&input->data, data);
             break;
-        }
         case complete_PlayerUpdate:
             if (!input->isComplete) {
                 input->isComplete = iTrue;
@@ -29,7 +29,7 @@ iDeclareTypeConstruction(Player)
 
 enum iPlayerUpdate {
     replace_PlayerUpdate,
-    append_PlayerUpdate,
+    append_PlayerUpdate, /* data contains only the new bytes */
     complete_PlayerUpdate,
 };
 
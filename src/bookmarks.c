@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/regexp.h>
+#include <the_Foundation/sortedarray.h>
 #include <the_Foundation/stringset.h>
 
 void init_Bookmark(iBookmark *d) {
@@ -83,13 +84,37 @@ static int cmpTitleAscending_Bookmark_(const iBookmark **a, const iBookmark **b)
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(BookmarkIndexEntry)
+
+struct Impl_BookmarkIndexEntry {
+    uint32_t key; /* hash of a case-folded URL or URL root */
+    uint32_t id;
+};
+
+static int cmp_BookmarkIndexEntry_(const void *a, const void *b) {
+    const iBookmarkIndexEntry *x = a, *y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return iCmp(x->id, y->id);
+}
+
+static uint32_t indexKey_Bookmarks_(iRangecc range) {
+    return hash32Case_Data(initial32_Hash, range.start, size_Range(&range));
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
 static const char *fileName_Bookmarks_ = "bookmarks.txt";
 
 struct Impl_Bookmarks {
-    iMutex *  mtx;
-    int       idEnum;
-    iHash     bookmarks; /* bookmark ID is the hash key */
-    iPtrArray remoteRequests;
+    iMutex *     mtx;
+    int          idEnum;
+    iHash        bookmarks; /* bookmark ID is the hash key */
+    iSortedArray urlIndex;  /* BookmarkIndexEntry keyed by URL */
+    iSortedArray iconIndex; /* BookmarkIndexEntry keyed by URL root; only user icons */
+    iBool        isIndexValid;
+    iPtrArray    remoteRequests;
 };
 
 iDefineTypeConstruction(Bookmarks)
@@ -98,6 +123,9 @@ void init_Bookmarks(iBookmarks *d) {
     d->mtx = new_Mutex();
     d->idEnum = 0;
     init_Hash(&d->bookmarks);
+    init_SortedArray(&d->urlIndex, sizeof(iBookmarkIndexEntry), cmp_BookmarkIndexEntry_);
+    init_SortedArray(&d->iconIndex, sizeof(iBookmarkIndexEntry), cmp_BookmarkIndexEntry_);
+    d->isIndexValid = iTrue;
     init_PtrArray(&d->remoteRequests);
 }
 
@@ -110,6 +138,8 @@ void deinit_Bookmarks(iBookmarks *d) {
     deinit_PtrArray(&d->remoteRequests);
     clear_Bookmarks(d);
     deinit_Hash(&d->bookmarks);
+    deinit_SortedArray(&d->iconIndex);
+    deinit_SortedArray(&d->urlIndex);
     delete_Mutex(d->mtx);
 }
 
@@ -119,19 +149,77 @@ void clear_Bookmarks(iBookmarks *d) {
         delete_Bookmark((iBookmark *) i.value);
     }
     clear_Hash(&d->bookmarks);
+    clear_SortedArray(&d->urlIndex);
+    clear_SortedArray(&d->iconIndex);
+    d->isIndexValid = iTrue;
     d->idEnum = 0;
     unlock_Mutex(d->mtx);
 }
 
+static void index_Bookmarks_(iBookmarks *d, const iBookmark *bm, iBool isSorted) {
+    /* When not sorted, the entries are just appended and the caller sorts the index. */
+    const iBookmarkIndexEntry urlEntry = { indexKey_Bookmarks_(range_String(&bm->url)),
+                                           id_Bookmark(bm) };
+    if (isSorted) {
+        insert_SortedArray(&d->urlIndex, &urlEntry);
+    }
+    else {
+        pushBack_Array(&d->urlIndex.values, &urlEntry);
+    }
+    if (bm->icon && hasTag_Bookmark(bm, userIcon_BookmarkTag)) {
+        const iBookmarkIndexEntry iconEntry = { indexKey_Bookmarks_(urlRoot_String(&bm->url)),
+                                                id_Bookmark(bm) };
+        if (isSorted) {
+            insert_SortedArray(&d->iconIndex, &iconEntry);
+        }
+        else {
+            pushBack_Array(&d->iconIndex.values, &iconEntry);
+        }
+    }
+}
+
+static void validateIndex_Bookmarks_(const iBookmarks *d) {
+    /* Called with the mutex locked. Removals and edits invalidate the whole index, because
+       they are much less frequent than lookups. */
+    iBookmarks *bms = iConstCast(iBookmarks *, d);
+    if (d->isIndexValid) {
+        return;
+    }
+    clear_SortedArray(&bms->urlIndex);
+    clear_SortedArray(&bms->iconIndex);
+    iConstForEach(Hash, i, &d->bookmarks) {
+        index_Bookmarks_(bms, (const iBookmark *) i.value, iFalse);
+    }
+    sort_Array(&bms->urlIndex.values, cmp_BookmarkIndexEntry_);
+    sort_Array(&bms->iconIndex.values, cmp_BookmarkIndexEntry_);
+    bms->isIndexValid = iTrue;
+}
+
+static size_t firstIndexed_Bookmarks_(const iSortedArray *index, uint32_t key) {
+    size_t pos;
+    locate_SortedArray(index, &(iBookmarkIndexEntry){ key, 0 }, &pos); /* IDs start at 1 */
+    return pos;
+}
+
 static void insert_Bookmarks_(iBookmarks *d, iBookmark *bookmark) {
     lock_Mutex(d->mtx);
     bookmark->node.key = ++d->idEnum;
     insert_Hash(&d->bookmarks, &bookmark->node);
+    if (d->isIndexValid) {
+        index_Bookmarks_(d, bookmark, iTrue);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+void reindex_Bookmarks(iBookmarks *d) {
+    lock_Mutex(d->mtx);
+    d->isIndexValid = iFalse;
     unlock_Mutex(d->mtx);
 }
 
 void load_Bookmarks(iBookmarks *d, const char *dirPath) {
     clear_Bookmarks(d);
+    d->isIndexValid = iFalse; /* indexed all at once when needed */
     iFile *f = newCStr_File(concatPath_CStr(dirPath, fileName_Bookmarks_));
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
         const iRangecc src = range_Block(collect_Block(readAll_File(f)));
@@ -229,6 +317,7 @@ iBool remove_Bookmarks(iBookmarks *d, uint32_t id) {
             }
         }
         delete_Bookmark(bm);
+        d->isIndexValid = iFalse;
     }
     unlock_Mutex(d->mtx);
     return bm != NULL;
@@ -243,7 +332,7 @@ iBool updateBookmarkIcon_Bookmarks(iBookmarks *d, const iString *url, iChar icon
         if (!hasTag_Bookmark(bm, remote_BookmarkTag) && !hasTag_Bookmark(bm, userIcon_BookmarkTag)) {
             if (icon != bm->icon) {
                 bm->icon = icon;
-                changed = iTrue;
+                changed = iTrue; /* not a user icon, so the index is unaffected */
             }
         }
     }
@@ -255,26 +344,22 @@ iChar siteIcon_Bookmarks(const iBookmarks *d, const iString *url) {
     if (isEmpty_String(url)) {
         return 0;
     }
-    static iRegExp *tagPattern_;
-    if (!tagPattern_) {
-        tagPattern_ = new_RegExp("\\b" userIcon_BookmarkTag "\\b", caseSensitive_RegExpOption);
-    }
     const iRangecc urlRoot      = urlRoot_String(url);
+    const uint32_t key          = indexKey_Bookmarks_(urlRoot);
     size_t         matchingSize = iInvalidSize; /* we'll pick the shortest matching */
     iChar          icon         = 0;
     lock_Mutex(d->mtx);
-    iConstForEach(Hash, i, &d->bookmarks) {
-        const iBookmark *bm = (const iBookmark *) i.value;
-        iRegExpMatch m;
-        init_RegExpMatch(&m);
-        if (bm->icon && matchString_RegExp(tagPattern_, &bm->tags, &m)) {
-            const iRangecc bmRoot = urlRoot_String(&bm->url);
-            if (equalRangeCase_Rangecc(urlRoot, bmRoot)) {
-                const size_t n = size_String(&bm->url);
-                if (n < matchingSize) {
-                    matchingSize = n;
-                    icon = bm->icon;
-                }
+    validateIndex_Bookmarks_(d);
+    for (size_t pos = firstIndexed_Bookmarks_(&d->iconIndex, key);
+         pos < size_SortedArray(&d->iconIndex); pos++) {
+        const iBookmarkIndexEntry *entry = constAt_SortedArray(&d->iconIndex, pos);
+        if (entry->key != key) break;
+        const iBookmark *bm = (const iBookmark *) value_Hash(&d->bookmarks, entry->id);
+        if (bm && bm->icon && equalRangeCase_Rangecc(urlRoot, urlRoot_String(&bm->url))) {
+            const size_t n = size_String(&bm->url);
+            if (n < matchingSize) {
+                matchingSize = n;
+                icon = bm->icon;
             }
         }
     }
@@ -292,15 +377,24 @@ iBool filterTagsRegExp_Bookmarks(void *regExp, const iBookmark *bm) {
     return matchString_RegExp(regExp, &bm->tags, &m);
 }
 
-static iBool matchUrl_(void *url, const iBookmark *bm) {
-    return equalCase_String(url, &bm->url);
-}
-
 uint32_t findUrl_Bookmarks(const iBookmarks *d, const iString *url) {
-    /* TODO: O(n), boo */
-    const iPtrArray *found = list_Bookmarks(d, NULL, matchUrl_, (void *) url);
-    if (isEmpty_PtrArray(found)) return 0;
-    return id_Bookmark(constFront_PtrArray(found));
+    const uint32_t   key   = indexKey_Bookmarks_(range_String(url));
+    const iBookmark *found = NULL;
+    lock_Mutex(d->mtx);
+    validateIndex_Bookmarks_(d);
+    for (size_t pos = firstIndexed_Bookmarks_(&d->urlIndex, key);
+         pos < size_SortedArray(&d->urlIndex); pos++) {
+        const iBookmarkIndexEntry *entry = constAt_SortedArray(&d->urlIndex, pos);
+        if (entry->key != key) break;
+        const iBookmark *bm = (const iBookmark *) value_Hash(&d->bookmarks, entry->id);
+        /* The most recently created one wins. */
+        if (bm && equalCase_String(url, &bm->url) &&
+            (!found || cmpTimeDescending_Bookmark_(&bm, &found) < 0)) {
+            found = bm;
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return found ? id_Bookmark(found) : 0;
 }
 
 const iPtrArray *list_Bookmarks(const iBookmarks *d, iBookmarksCompareFunc cmp,
@@ -491,6 +585,7 @@ void fetchRemote_Bookmarks(iBookmarks *d) {
             }
         }
         if (numRemoved) {
+            d->isIndexValid = iFalse;
             postCommand_App("bookmarks.changed");
         }
     }
@@ -502,6 +597,7 @@ void fetchRemote_Bookmarks(iBookmarks *d) {
         setUserData_Object(req, bmId);
         pushBack_PtrArray(&d->remoteRequests, req);
         setUrl_GmRequest(req, &bm->url);
+        setPriority_GmRequest(req, background_GmRequestPriority);
         iConnect(GmRequest, req, finished, req, remoteRequestFinished_Bookmarks_);
         submit_GmRequest(req);
     }
@@ -80,6 +80,7 @@ void        load_Bookmarks              (iBookmarks *, const char *dirPath);
 uint32_t    add_Bookmarks               (iBookmarks *, const iString *url, const iString *title,
                                          const iString *tags, iChar icon);
 iBool       remove_Bookmarks            (iBookmarks *, uint32_t id);
+void        reindex_Bookmarks           (iBookmarks *); /* after editing a URL, tags, or icon */
 iBookmark * get_Bookmarks               (iBookmarks *, uint32_t id);
 void        fetchRemote_Bookmarks       (iBookmarks *);
 void        requestFinished_Bookmarks   (iBookmarks *, iGmRequest *req);
@@ -87,7 +88,7 @@ iBool       updateBookmarkIcon_Bookmarks(iBookmarks *, const iString *url, iChar
 iChar       siteIcon_Bookmarks          (const iBookmarks *, const iString *url);
 
 void        save_Bookmarks              (const iBookmarks *, const char *dirPath);
-uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url); /* O(n) */
+uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url);
 
 typedef iBool (*iBookmarksFilterFunc) (void *context, const iBookmark *);
 typedef int   (*iBookmarksCompareFunc)(const iBookmark **, const iBookmark **);
@@ -29,9 +29,11 @@ enum iFileVersion {
     addedResponseTimestamps_FileVersion = 1,
     multipleRoots_FileVersion           = 2,
     serializedSidebarState_FileVersion  = 3,
+    diskCachedResponses_FileVersion     = 4,
+    savedTabTitles_FileVersion          = 5,
     /* meta */
     idents_FileVersion = 1, /* version used by GmCerts/idents.lgr */
-    latest_FileVersion = 3,
+    latest_FileVersion = 5,
 };
 
 /* Icons */
@@ -98,8 +98,13 @@ static void init_FeedJob(iFeedJob *d, const iBookmark *bookmark) {
     d->checkHeadings = hasTag_Bookmark(bookmark, headings_BookmarkTag);
 }
 
+static void requestFinished_FeedJob_(iAnyObject *obj, iGmRequest *req);
+
 static void deinit_FeedJob(iFeedJob *d) {
-    iRelease(d->request);
+    if (d->request) {
+        iDisconnect(GmRequest, d->request, finished, d->request, requestFinished_FeedJob_);
+        iRelease(d->request);
+    }
     iForEach(PtrArray, i, &d->results) {
         delete_FeedEntry(i.ptr);
     }
@@ -111,10 +116,38 @@ static iBool isTimedOut_FeedJob_(iFeedJob *d) {
     return elapsedSeconds_Time(&d->startTime) > requestTimeoutSeconds_FeedJob_;
 }
 
+static double secondsUntilTimeout_FeedJob_(const iFeedJob *d) {
+    return iMax(0.0, requestTimeoutSeconds_FeedJob_ - elapsedSeconds_Time(&d->startTime));
+}
+
 iDefineTypeConstructionArgs(FeedJob, (const iBookmark *bm), bm)
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(FeedFingerprint)
+
+/* Identifies the contents of the last successfully fetched page of a subscription. */
+struct Impl_FeedFingerprint {
+    iHashNode node; /* bookmark ID */
+    uint64_t  hash;
+    uint64_t  size;
+};
+
+static iFeedFingerprint fingerprint_FeedJob_(const iFeedJob *d) {
+    const iBlock *   body = body_GmRequest(d->request);
+    iFeedFingerprint fp   = {
+        .hash = hash64_Data(initial64_Hash, constData_Block(body), size_Block(body)),
+        .size = size_Block(body)
+    };
+    fp.node.key = d->bookmarkId;
+    if (d->checkHeadings) {
+        fp.hash = ~fp.hash; /* parsed differently */
+    }
+    return fp;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
 static const char *feedsFilename_Feeds_         = "feeds.txt";
 static const int   updateIntervalSeconds_Feeds_ = 4 * 60 * 60;
 
@@ -126,17 +159,29 @@ struct Impl_Feeds {
     int       refreshTimer;
     iThread * worker;
     iBool     stopWorker;
+    iMutex    jobMtx;
+    iCondition jobFinished; /* wakes up the worker */
     iPtrArray jobs; /* pending */
+    iHash     fingerprints; /* FeedFingerprint; skip parsing if unchanged */
     iSortedArray entries; /* pointers to all discovered feed entries, sorted by entry ID (URL) */
 };
 
 static iFeeds feeds_;
 
-#define maxConcurrentRequests_Feeds 4
+static void requestFinished_FeedJob_(iAnyObject *obj, iGmRequest *req) {
+    /* Called in the request's thread. */
+    iFeeds *d = &feeds_;
+    iUnused(obj, req);
+    lock_Mutex(&d->jobMtx);
+    signal_Condition(&d->jobFinished);
+    unlock_Mutex(&d->jobMtx);
+}
 
 static void submit_FeedJob_(iFeedJob *d) {
     d->request = new_GmRequest(certs_App());
     setUrl_GmRequest(d->request, &d->url);
+    setPriority_GmRequest(d->request, background_GmRequestPriority);
+    iConnect(GmRequest, d->request, finished, d->request, requestFinished_FeedJob_);
     initCurrent_Time(&d->startTime);
     submit_GmRequest(d->request);
 }
@@ -156,14 +201,25 @@ static const iPtrArray *listSubscriptions_(void) {
     return list_Bookmarks(bookmarks_App(), NULL, isSubscribed_, NULL);
 }
 
-static iFeedJob *startNextJob_Feeds_(iFeeds *d) {
-    if (isEmpty_PtrArray(&d->jobs)) {
-        return NULL;
+static iFeedJob *startNextJob_Feeds_(iFeeds *d, const iPtrArray *ongoing, size_t maxPerHost) {
+    /* Pick the first pending job whose host isn't already busy with our requests. */
+    iForEach(PtrArray, i, &d->jobs) {
+        iFeedJob *     job     = i.ptr;
+        const iRangecc host    = urlHost_String(&job->url);
+        size_t         numHost = 0;
+        iConstForEach(PtrArray, j, ongoing) {
+            const iFeedJob *other = j.ptr;
+            if (equalRangeCase_Rangecc(host, urlHost_String(&other->url))) {
+                numHost++;
+            }
+        }
+        if (numHost < maxPerHost) {
+            remove_PtrArrayIterator(&i);
+            submit_FeedJob_(job);
+            return job;
+        }
     }
-    iFeedJob *job;
-    take_PtrArray(&d->jobs, 0, (void **) &job);
-    submit_FeedJob_(job);
-    return job;
+    return NULL;
 }
 
 static iBool isTrimmablePunctuation_(iChar c) {
@@ -269,6 +325,13 @@ static void save_Feeds_(iFeeds *d) {
                 write_File(f, utf8_String(str));
             }
         }
+        writeData_File(f, "# Fingerprints\n", 15);
+        iConstForEach(Hash, j, &d->fingerprints) {
+            const iFeedFingerprint *fp = (const iFeedFingerprint *) j.value;
+            format_String(str, "%08x %016llx %llu\n", fp->node.key,
+                          (unsigned long long) fp->hash, (unsigned long long) fp->size);
+            write_File(f, utf8_String(str));
+        }
         writeData_File(f, "# Entries\n", 10);
         iTime now;
         initCurrent_Time(&now);
@@ -346,52 +409,108 @@ static iBool updateEntries_Feeds_(iFeeds *d, iPtrArray *incoming) {
     return gotNew;
 }
 
+static iBool isUnchanged_Feeds_(iFeeds *d, const iFeedJob *job) {
+    /* Remembers the fingerprint of a successful response, and checks if it was the same the
+       last time. */
+    if (!isSuccess_GmStatusCode(status_GmRequest(job->request))) {
+        return iFalse;
+    }
+    const iFeedFingerprint fp = fingerprint_FeedJob_(job);
+    iBool isSame = iFalse;
+    lock_Mutex(d->mtx);
+    iFeedFingerprint *old = (iFeedFingerprint *) value_Hash(&d->fingerprints, fp.node.key);
+    if (old) {
+        isSame = (old->hash == fp.hash && old->size == fp.size);
+    }
+    else {
+        old = iMalloc(FeedFingerprint);
+        old->node.key = fp.node.key;
+        insert_Hash(&d->fingerprints, &old->node);
+    }
+    old->hash = fp.hash;
+    old->size = fp.size;
+    unlock_Mutex(d->mtx);
+    return isSame;
+}
+
+static iBool isAnyFinished_FeedJobs_(const iPtrArray *jobs, double *secondsUntilTimeout) {
+    *secondsUntilTimeout = requestTimeoutSeconds_FeedJob_;
+    iConstForEach(PtrArray, i, jobs) {
+        const iFeedJob *job = i.ptr;
+        if (isFinished_GmRequest(job->request)) {
+            return iTrue;
+        }
+        *secondsUntilTimeout = iMin(*secondsUntilTimeout, secondsUntilTimeout_FeedJob_(job));
+    }
+    return iFalse;
+}
+
 static iThreadResult fetch_Feeds_(iThread *thread) {
     iFeeds *d = &feeds_;
     iUnused(thread);
-    iFeedJob *work[maxConcurrentRequests_Feeds]; /* We'll do a couple of concurrent requests. */
-    iZap(work);
-    iBool gotNew = iFalse;
+    const size_t maxOngoing = iMax(1, prefs_App()->maxFeedRequests);
+    const size_t maxPerHost = iMax(1, prefs_App()->maxFeedRequestsPerHost);
+    iPtrArray    ongoing;
+    init_PtrArray(&ongoing);
+    iBool  gotNew     = iFalse;
+    size_t numParsed  = 0;
+    size_t numSkipped = 0;
     postCommand_App("feeds.update.started");
     while (!d->stopWorker) {
         /* Start new jobs. */
-        iForIndices(i, work) {
-            if (!work[i]) {
-                work[i] = startNextJob_Feeds_(d);
+        while (size_PtrArray(&ongoing) < maxOngoing) {
+            iFeedJob *job = startNextJob_Feeds_(d, &ongoing, maxPerHost);
+            if (!job) break;
+            pushBack_PtrArray(&ongoing, job);
+        }
+        /* Stop if everything has finished. */
+        if (isEmpty_PtrArray(&ongoing)) {
+            break;
+        }
+        /* Sleep until a request finishes or times out. */ {
+            double timeout;
+            lock_Mutex(&d->jobMtx);
+            if (!d->stopWorker && !isAnyFinished_FeedJobs_(&ongoing, &timeout)) {
+                iTime until;
+                initTimeout_Time(&until, timeout);
+                waitTimeout_Condition(&d->jobFinished, &d->jobMtx, &until);
             }
+            unlock_Mutex(&d->jobMtx);
         }
-        sleep_Thread(0.5); /* TODO: wait on a Condition so we can exit quickly */
         if (d->stopWorker) break;
-        size_t ongoing = 0;
-        iForIndices(i, work) {
-            if (work[i]) {
-                if (isFinished_GmRequest(work[i]->request)) {
-                    /* TODO: Handle redirects. Need to resubmit the job with new URL. */
-                    parseResult_FeedJob_(work[i]);
-                    gotNew |= updateEntries_Feeds_(d, &work[i]->results);
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
-                }
-                else if (isTimedOut_FeedJob_(work[i])) {
-                    /* Maybe we'll get it next time! */
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
+        iForEach(PtrArray, i, &ongoing) {
+            iFeedJob *job = i.ptr;
+            if (isFinished_GmRequest(job->request)) {
+                /* TODO: Handle redirects. Need to resubmit the job with new URL. */
+                if (isUnchanged_Feeds_(d, job)) {
+                    numSkipped++;
                 }
                 else {
-                    ongoing++;
+                    parseResult_FeedJob_(job);
+                    gotNew |= updateEntries_Feeds_(d, &job->results);
+                    numParsed++;
                 }
-                /* TODO: abort job if it takes too long (> 15 seconds?) */
+                delete_FeedJob(job);
+                remove_PtrArrayIterator(&i);
+            }
+            else if (isTimedOut_FeedJob_(job)) {
+                /* Maybe we'll get it next time! */
+                delete_FeedJob(job);
+                remove_PtrArrayIterator(&i);
             }
         }
-        /* Stop if everything has finished. */
-        if (ongoing == 0 && isEmpty_PtrArray(&d->jobs)) {
-            break;
-        }
     }
+    iForEach(PtrArray, i, &ongoing) {
+        delete_FeedJob(i.ptr); /* cancelled */
+    }
+    deinit_PtrArray(&ongoing);
     initCurrent_Time(&d->lastRefreshedAt);
     save_Feeds_(d);
-    postCommandf_App("feeds.update.finished arg:%d unread:%zu", gotNew ? 1 : 0,
-                     numUnread_Feeds());
+    postCommandf_App("feeds.update.finished arg:%d unread:%zu parsed:%zu skipped:%zu",
+                     gotNew ? 1 : 0,
+                     numUnread_Feeds(),
+                     numParsed,
+                     numSkipped);
     return 0;
 }
 
@@ -428,7 +547,10 @@ static uint32_t refresh_Feeds_(uint32_t interval, void *data) {
 
 static void stopWorker_Feeds_(iFeeds *d) {
     if (d->worker) {
+        lock_Mutex(&d->jobMtx);
         d->stopWorker = iTrue;
+        signal_Condition(&d->jobFinished);
+        unlock_Mutex(&d->jobMtx);
         join_Thread(d->worker);
         iReleasePtr(&d->worker);
     }
@@ -469,6 +591,10 @@ static void load_Feeds_(iFeeds *d) {
                 section = 1;
                 continue;
             }
+            else if (equal_Rangecc(line, "# Fingerprints")) {
+                section = 3;
+                continue;
+            }
             else if (equal_Rangecc(line, "# Entries")) {
                 section = 2;
                 continue;
@@ -542,6 +668,22 @@ static void load_Feeds_(iFeeds *d) {
                     delete_String(url);
                     break;
                 }
+                case 3: {
+                    uint32_t           id   = 0;
+                    unsigned long long hash = 0;
+                    unsigned long long size = 0;
+                    if (sscanf(line.start, "%08x %016llx %llu", &id, &hash, &size) == 3) {
+                        const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, id);
+                        if (node) {
+                            iFeedFingerprint *fp = iMalloc(FeedFingerprint);
+                            fp->node.key = node->bookmarkId;
+                            fp->hash     = hash;
+                            fp->size     = size;
+                            free(insert_Hash(&d->fingerprints, &fp->node));
+                        }
+                    }
+                    break;
+                }
             }
         }
     aborted:
@@ -564,7 +706,10 @@ void init_Feeds(const char *saveDir) {
     init_IntSet(&d->previouslyCheckedFeeds);
     iZap(d->lastRefreshedAt);
     d->worker = NULL;
+    init_Mutex(&d->jobMtx);
+    init_Condition(&d->jobFinished);
     init_PtrArray(&d->jobs);
+    init_Hash(&d->fingerprints);
     init_SortedArray(&d->entries, sizeof(iFeedEntry *), cmp_FeedEntryPtr_);
     load_Feeds_(d);
     /* Update feeds if it has been a while. */
@@ -582,12 +727,18 @@ void deinit_Feeds(void) {
     stopWorker_Feeds_(d);
     iAssert(isEmpty_PtrArray(&d->jobs));
     deinit_PtrArray(&d->jobs);
+    deinit_Condition(&d->jobFinished);
+    deinit_Mutex(&d->jobMtx);
     deinit_String(&d->saveDir);
     delete_Mutex(d->mtx);
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
         delete_FeedEntry(*entry);
     }
+    iForEach(Hash, j, &d->fingerprints) {
+        free(j.value);
+    }
+    deinit_Hash(&d->fingerprints);
     deinit_IntSet(&d->previouslyCheckedFeeds);
     deinit_SortedArray(&d->entries);
 }
@@ -609,6 +760,10 @@ void removeEntries_Feeds(uint32_t feedBookmarkId) {
             remove_ArrayIterator(&i);
         }
     }
+    /* Parse it again if resubscribed. */
+    lock_Mutex(d->mtx);
+    free(remove_Hash(&d->fingerprints, feedBookmarkId));
+    unlock_Mutex(d->mtx);
 }
 
 static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
@@ -343,11 +343,14 @@ iBool preloadCoverImage_Gempub(const iGempub *d, iGmDocument *doc) {
         if (linkFlags_GmDocument(doc, linkId) & imageFileExtension_GmLinkFlag) {
             iString *imgEntryPath = collect_String(copy_String(linkUrl));
             remove_Block(&imgEntryPath->chars, 0, size_String(&d->baseUrl) + 1 /* slash, too */);
+            iGmBody *imgData = new_GmBody();
+            set_GmBody(imgData, data_Archive(d->arch, imgEntryPath));
             setData_Media(media_GmDocument(doc),
                           linkId,
                           collectNewCStr_String(mediaType_Path(linkUrl)),
-                          data_Archive(d->arch, imgEntryPath),
+                          imgData,
                           0);
+            delete_GmBody(imgData);
             haveImage = iTrue;
         }
     }
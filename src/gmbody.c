@@ -0,0 +1,325 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#define _FILE_OFFSET_BITS 64 /* spill files may be larger than 2 GB */
+
+#include "gmbody.h"
+
+#include <the_Foundation/stream.h>
+#include <string.h>
+
+#define chunkSize_GmBody_   ((size_t) 64 * 1024)
+
+iDefineTypeConstruction(GmBody)
+
+void init_GmBody(iGmBody *d) {
+    init_PtrArray(&d->chunks);
+    d->size      = 0;
+    d->spillSize = 0;
+    d->spill     = NULL;
+    d->joined    = NULL;
+    d->sink      = NULL;
+}
+
+void initCopy_GmBody(iGmBody *d, const iGmBody *other) {
+    init_GmBody(d);
+    d->spillSize = other->spillSize;
+    if (other->sink) {
+        /* The data is only in the sink file. */
+    }
+    else if (other->spill) {
+        /* Copied piece by piece so the data doesn't have to fit in memory. */
+        iGmBodyReader reader;
+        init_GmBodyReader(&reader);
+        iRangecc data;
+        while (readNext_GmBodyReader(&reader, other, &data)) {
+            appendData_GmBody(d, data.start, size_Range(&data));
+        }
+        deinit_GmBodyReader(&reader);
+    }
+    else {
+        /* Blocks are implicitly shared, so this doesn't copy the contents. A body that has
+           already been joined into a single chunk is shared as one block. */
+        iConstForEach(PtrArray, i, &other->chunks) {
+            pushBack_PtrArray(&d->chunks, copy_Block(i.ptr));
+        }
+        d->size = other->size;
+    }
+}
+
+void deinit_GmBody(iGmBody *d) {
+    clear_GmBody(d);
+    deinit_PtrArray(&d->chunks);
+}
+
+void serialize_GmBody(const iGmBody *d, iStream *outs) {
+    iBlock data;
+    init_Block(&data, 0);
+    getData_GmBody(d, &data);
+    serialize_Block(&data, outs);
+    deinit_Block(&data);
+}
+
+void deserialize_GmBody(iGmBody *d, iStream *ins) {
+    clear_GmBody(d);
+    iBlock *data = new_Block(0);
+    deserialize_Block(data, ins);
+    d->size = size_Block(data);
+    pushBack_PtrArray(&d->chunks, data);
+}
+
+static void spill_GmBody_(iGmBody *d) {
+    iAssert(!d->spill);
+    d->spill = tmpfile();
+    if (!d->spill) {
+        d->spillSize = 0; /* keep everything in memory, then */
+        return;
+    }
+    iForEach(PtrArray, i, &d->chunks) {
+        fwrite(constData_Block(i.ptr), 1, size_Block(i.ptr), d->spill);
+        delete_Block(i.ptr);
+    }
+    clear_PtrArray(&d->chunks);
+}
+
+void setSpillSize_GmBody(iGmBody *d, size_t spillSize) {
+    d->spillSize = spillSize;
+    if (spillSize && d->size > spillSize && !d->spill) {
+        spill_GmBody_(d);
+    }
+}
+
+void setSink_GmBody(iGmBody *d, iFile *sink) {
+    iAssert(sink);
+    iGmBodyReader reader;
+    init_GmBodyReader(&reader);
+    iRangecc data;
+    while (readNext_GmBodyReader(&reader, d, &data)) {
+        writeData_File(sink, data.start, size_Range(&data));
+    }
+    deinit_GmBodyReader(&reader);
+    const size_t size = d->size;
+    clear_GmBody(d);
+    d->size = size;
+    d->sink = sink;
+}
+
+void clear_GmBody(iGmBody *d) {
+    iForEach(PtrArray, i, &d->chunks) {
+        delete_Block(i.ptr);
+    }
+    clear_PtrArray(&d->chunks);
+    if (d->spill) {
+        fclose(d->spill); /* temporary file is removed automatically */
+        d->spill = NULL;
+    }
+    delete_Block(d->joined);
+    d->joined = NULL;
+    d->sink   = NULL;
+    d->size   = 0;
+}
+
+void set_GmBody(iGmBody *d, const iBlock *data) {
+    clear_GmBody(d);
+    if (!isEmpty_Block(data)) {
+        pushBack_PtrArray(&d->chunks, copy_Block(data));
+        d->size = size_Block(data);
+        setSpillSize_GmBody(d, d->spillSize);
+    }
+}
+
+void setData_GmBody(iGmBody *d, const void *data, size_t size) {
+    clear_GmBody(d);
+    appendData_GmBody(d, data, size);
+}
+
+void append_GmBody(iGmBody *d, const iBlock *data) {
+    appendData_GmBody(d, constData_Block(data), size_Block(data));
+}
+
+void appendCStr_GmBody(iGmBody *d, const char *cstr) {
+    appendData_GmBody(d, cstr, strlen(cstr));
+}
+
+void appendData_GmBody(iGmBody *d, const void *data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    if (d->spillSize && d->size + size > d->spillSize && !d->spill && !d->sink) {
+        spill_GmBody_(d);
+    }
+    d->size += size;
+    if (d->sink) {
+        writeData_File(d->sink, data, size);
+        return;
+    }
+    if (d->spill) {
+        fseek(d->spill, 0, SEEK_END);
+        fwrite(data, 1, size, d->spill);
+        return;
+    }
+    const char *ptr = data;
+    while (size) {
+        iBlock *last = isEmpty_PtrArray(&d->chunks)
+                           ? NULL
+                           : at_PtrArray(&d->chunks, size_PtrArray(&d->chunks) - 1);
+        if (!last || size_Block(last) >= chunkSize_GmBody_) {
+            last = new_Block(0);
+            reserve_Block(last, chunkSize_GmBody_);
+            pushBack_PtrArray(&d->chunks, last);
+        }
+        const size_t avail = iMin(chunkSize_GmBody_ - size_Block(last), size);
+        appendData_Block(last, ptr, avail);
+        ptr  += avail;
+        size -= avail;
+    }
+}
+
+size_t size_GmBody(const iGmBody *d) {
+    return d->size;
+}
+
+iBool isSpilled_GmBody(const iGmBody *d) {
+    return d->spill != NULL;
+}
+
+const iFile *sink_GmBody(const iGmBody *d) {
+    return d->sink;
+}
+
+static int seekSpill_GmBody_(FILE *spill, uint64_t pos) {
+    /* `long` may be only 32 bits wide. */
+#if defined (iPlatformMsys)
+    return _fseeki64(spill, (__int64) pos, SEEK_SET);
+#else
+    return fseeko(spill, (off_t) pos, SEEK_SET);
+#endif
+}
+
+static size_t readSpilled_GmBody_(const iGmBody *d, size_t pos, size_t size, void *data_out) {
+    iAssert(d->spill);
+    fflush(d->spill);
+    if (seekSpill_GmBody_(d->spill, pos)) {
+        return 0;
+    }
+    return fread(data_out, 1, size, d->spill);
+}
+
+void getData_GmBody(const iGmBody *d, iBlock *data_out) {
+    if (d->spill) {
+        resize_Block(data_out, d->size);
+        truncate_Block(data_out, readSpilled_GmBody_(d, 0, d->size, data_Block(data_out)));
+    }
+    else if (size_PtrArray(&d->chunks) == 1) {
+        set_Block(data_out, constFront_PtrArray(&d->chunks));
+    }
+    else {
+        clear_Block(data_out);
+        reserve_Block(data_out, d->size);
+        iConstForEach(PtrArray, i, &d->chunks) {
+            append_Block(data_out, i.ptr);
+        }
+    }
+}
+
+void join_GmBody(iGmBody *d) {
+    /* Copies of a joined body all share the same block. */
+    if (!d->spill && !d->sink && size_PtrArray(&d->chunks) != 1) {
+        iBlock *joined = new_Block(0);
+        getData_GmBody(d, joined);
+        iForEach(PtrArray, i, &d->chunks) {
+            delete_Block(i.ptr);
+        }
+        clear_PtrArray(&d->chunks);
+        pushBack_PtrArray(&d->chunks, joined);
+    }
+}
+
+const iBlock *data_GmBody(iGmBody *d) {
+    if (d->spill) {
+        /* The data is only on disk otherwise. */
+        if (!d->joined) {
+            d->joined = new_Block(0);
+        }
+        if (size_Block(d->joined) != d->size) {
+            getData_GmBody(d, d->joined);
+        }
+        return d->joined;
+    }
+    join_GmBody(d);
+    if (isEmpty_PtrArray(&d->chunks)) {
+        pushBack_PtrArray(&d->chunks, new_Block(0)); /* sink */
+    }
+    return constFront_PtrArray(&d->chunks);
+}
+
+static const iBlock *chunk_GmBody_(const iGmBody *d, size_t pos, size_t *start_out) {
+    /* The first chunk may be of any size, but the rest are all full-sized. */
+    const iBlock *first     = constFront_PtrArray(&d->chunks);
+    const size_t  firstSize = size_Block(first);
+    if (pos < firstSize) {
+        *start_out = 0;
+        return first;
+    }
+    const size_t index = (pos - firstSize) / chunkSize_GmBody_ + 1;
+    *start_out = firstSize + (index - 1) * chunkSize_GmBody_;
+    return constAt_PtrArray(&d->chunks, index);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDefineTypeConstruction(GmBodyReader)
+
+void init_GmBodyReader(iGmBodyReader *d) {
+    d->pos = 0;
+    init_Block(&d->buffer, 0);
+}
+
+void deinit_GmBodyReader(iGmBodyReader *d) {
+    deinit_Block(&d->buffer);
+}
+
+void reset_GmBodyReader(iGmBodyReader *d) {
+    d->pos = 0;
+    clear_Block(&d->buffer);
+}
+
+iBool readNext_GmBodyReader(iGmBodyReader *d, const iGmBody *body, iRangecc *data_out) {
+    if (d->pos >= size_GmBody(body) || body->sink) {
+        *data_out = iNullRange;
+        return iFalse;
+    }
+    if (body->spill) {
+        resize_Block(&d->buffer, iMin(chunkSize_GmBody_, body->size - d->pos));
+        truncate_Block(&d->buffer,
+                       readSpilled_GmBody_(body, d->pos, size_Block(&d->buffer), data_Block(&d->buffer)));
+        *data_out = range_Block(&d->buffer);
+    }
+    else {
+        size_t        start;
+        const iBlock *chunk = chunk_GmBody_(body, d->pos, &start);
+        *data_out = (iRangecc){ constBegin_Block(chunk) + d->pos - start, constEnd_Block(chunk) };
+    }
+    d->pos += size_Range(data_out);
+    return !isEmpty_Range(data_out);
+}
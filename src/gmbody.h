@@ -0,0 +1,84 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#pragma once
+
+#include <the_Foundation/block.h>
+#include <the_Foundation/file.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/range.h>
+#include <stdio.h>
+
+/* Response body that grows in fixed-size chunks, so appending never needs to reallocate and
+   copy the previously received data. Above the spill size, the data is moved to a temporary
+   file. Consumers can use a GmBodyReader to process only the bytes they haven't seen yet.
+   With a sink, the data is only written to the sink file and just its size is kept. */
+
+iDeclareType(GmBody)
+iDeclareType(GmBodyReader)
+
+struct Impl_GmBody {
+    iPtrArray chunks; /* iBlock *; only the first and last may be of different size */
+    size_t    size;
+    size_t    spillSize; /* zero if never spilled */
+    FILE *    spill;     /* all of the data after spilling */
+    iBlock *  joined;    /* spilled data read back into memory */
+    iFile *   sink;      /* not owned */
+};
+
+iDeclareTypeConstruction(GmBody)
+iDeclareTypeSerialization(GmBody)
+
+void            initCopy_GmBody     (iGmBody *, const iGmBody *other);
+
+void            setSpillSize_GmBody (iGmBody *, size_t spillSize);
+void            setSink_GmBody      (iGmBody *, iFile *sink); /* existing data is moved to sink */
+void            clear_GmBody        (iGmBody *);
+void            set_GmBody          (iGmBody *, const iBlock *data);
+void            setData_GmBody      (iGmBody *, const void *data, size_t size);
+void            append_GmBody       (iGmBody *, const iBlock *data);
+void            appendData_GmBody   (iGmBody *, const void *data, size_t size);
+void            appendCStr_GmBody   (iGmBody *, const char *cstr);
+void            join_GmBody         (iGmBody *); /* when complete; replaces chunks with one block */
+
+size_t          size_GmBody         (const iGmBody *);
+iBool           isSpilled_GmBody    (const iGmBody *);
+const iFile *   sink_GmBody         (const iGmBody *);
+void            getData_GmBody      (const iGmBody *, iBlock *data_out); /* shares a single block */
+const iBlock *  data_GmBody         (iGmBody *); /* joins the chunks */
+
+iLocalDef iBool isEmpty_GmBody(const iGmBody *d) {
+    return size_GmBody(d) == 0;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+struct Impl_GmBodyReader {
+    size_t pos;
+    iBlock buffer; /* data read from a spilled body */
+};
+
+iDeclareTypeConstruction(GmBodyReader)
+
+void    reset_GmBodyReader      (iGmBodyReader *);
+iBool   readNext_GmBodyReader   (iGmBodyReader *, const iGmBody *body, iRangecc *data_out);
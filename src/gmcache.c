@@ -0,0 +1,435 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include "gmcache.h"
+#include "gmrequest.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/sortedarray.h>
+#include <the_Foundation/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char *indexFileName_GmCache_ = "index.lgr";
+static const char *magicIndex_GmCache_    = "lgrc";
+
+enum iGmCacheIndexVersion {
+    initial_GmCacheIndexVersion = 0,
+    latest_GmCacheIndexVersion  = 0,
+};
+
+iDeclareType(GmCacheEntry)
+
+struct Impl_GmCacheEntry {
+    uint32_t urlHash;
+    iString  url;
+    uint64_t blob; /* content hash; names the blob file */
+    size_t   size;
+    int      statusCode;
+    iString  meta;
+    int      certFlags;
+    iTime    when;     /* response received */
+    iTime    lastUsed;
+};
+
+static void deinit_GmCacheEntry_(iGmCacheEntry *d) {
+    deinit_String(&d->url);
+    deinit_String(&d->meta);
+}
+
+static int cmp_GmCacheEntry_(const void *a, const void *b) {
+    const iGmCacheEntry *x = a, *y = b;
+    if (x->urlHash != y->urlHash) {
+        return x->urlHash < y->urlHash ? -1 : 1;
+    }
+    return cmpString_String(&x->url, &y->url);
+}
+
+static uint32_t urlHash_(const iString *url) {
+    return hash32_Data(initial32_Hash, cstr_String(url), size_String(url));
+}
+
+static uint64_t contentHash_(const iGmBody *body) {
+    uint64_t hash = initial64_Hash;
+    iGmBodyReader reader;
+    init_GmBodyReader(&reader);
+    iRangecc data;
+    while (readNext_GmBodyReader(&reader, body, &data)) {
+        hash = hash64_Data(hash, data.start, size_Range(&data));
+    }
+    deinit_GmBodyReader(&reader);
+    return hash ^ size_GmBody(body);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+struct Impl_GmCache {
+    iMutex       mtx;
+    iString      dir;
+    iSortedArray entries; /* GmCacheEntry, ordered by URL hash */
+    size_t       totalSize; /* bytes; blobs shared by multiple entries are counted once */
+    size_t       maxSize;
+    size_t       numHits;
+    size_t       numMisses;
+};
+
+iDefineTypeConstructionArgs(GmCache, (const char *dir), dir)
+
+static const char *blobPath_GmCache_(const iGmCache *d, uint64_t blob) {
+    return concatPath_CStr(cstr_String(&d->dir),
+                           cstr_String(collectNewFormat_String(
+                               "%016llx.bin", (unsigned long long) blob)));
+}
+
+static size_t numBlobRefs_GmCache_(const iGmCache *d, uint64_t blob) {
+    size_t count = 0;
+    iConstForEach(Array, i, &d->entries.values) {
+        if (((const iGmCacheEntry *) i.value)->blob == blob) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void removeAt_GmCache_(iGmCache *d, size_t pos) {
+    iGmCacheEntry *entry = at_SortedArray(&d->entries, pos);
+    const uint64_t blob = entry->blob;
+    const size_t   size = entry->size;
+    deinit_GmCacheEntry_(entry);
+    remove_SortedArray(&d->entries, pos);
+    if (numBlobRefs_GmCache_(d, blob) == 0) {
+        remove(blobPath_GmCache_(d, blob));
+        d->totalSize -= size;
+    }
+}
+
+static void evict_GmCache_(iGmCache *d) {
+    while (d->totalSize > d->maxSize && !isEmpty_SortedArray(&d->entries)) {
+        size_t oldest = 0;
+        iConstForEach(Array, i, &d->entries.values) {
+            const iGmCacheEntry *entry = i.value;
+            if (cmp_Time(&entry->lastUsed,
+                         &((const iGmCacheEntry *) constAt_SortedArray(&d->entries, oldest))
+                              ->lastUsed) < 0) {
+                oldest = index_ArrayConstIterator(&i);
+            }
+        }
+        removeAt_GmCache_(d, oldest);
+    }
+}
+
+static void load_GmCache_(iGmCache *d) {
+    iFile *f = newCStr_File(concatPath_CStr(cstr_String(&d->dir), indexFileName_GmCache_));
+    if (open_File(f, readOnly_FileMode)) {
+        char magic[4];
+        readData_File(f, 4, magic);
+        if (!memcmp(magic, magicIndex_GmCache_, 4) &&
+            readU32_File(f) <= latest_GmCacheIndexVersion) {
+            iStream *ins = stream_File(f);
+            for (uint32_t count = readU32_Stream(ins); count > 0 && !atEnd_File(f); count--) {
+                iGmCacheEntry entry;
+                init_String(&entry.url);
+                init_String(&entry.meta);
+                deserialize_String(&entry.url, ins);
+                entry.urlHash    = urlHash_(&entry.url);
+                entry.blob       = readU64_Stream(ins);
+                entry.size       = readU64_Stream(ins);
+                entry.statusCode = read32_Stream(ins);
+                deserialize_String(&entry.meta, ins);
+                entry.certFlags  = read32_Stream(ins);
+                iZap(entry.when);
+                iZap(entry.lastUsed);
+                entry.when.ts.tv_sec     = readU64_Stream(ins);
+                entry.lastUsed.ts.tv_sec = readU64_Stream(ins);
+                if (!fileExistsCStr_FileInfo(blobPath_GmCache_(d, entry.blob))) {
+                    deinit_GmCacheEntry_(&entry);
+                    continue;
+                }
+                if (numBlobRefs_GmCache_(d, entry.blob) == 0) {
+                    d->totalSize += entry.size;
+                }
+                insert_SortedArray(&d->entries, &entry);
+            }
+        }
+    }
+    iRelease(f);
+}
+
+static int cmpBlob_GmCache_(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void sweep_GmCache_(iGmCache *d) {
+    /* Remove blobs that are not in the index, for example because the index was not saved
+       after they were written, and temporary files of writes that never finished. */
+    iSortedArray refs;
+    init_SortedArray(&refs, sizeof(uint64_t), cmpBlob_GmCache_);
+    iConstForEach(Array, e, &d->entries.values) {
+        pushBack_Array(&refs.values, &((const iGmCacheEntry *) e.value)->blob);
+    }
+    sort_Array(&refs.values, cmpBlob_GmCache_);
+    iForEach(DirFileInfo, i, iClob(directoryContents_FileInfo(iClob(new_FileInfo(&d->dir))))) {
+        const iString *path = path_FileInfo(i.value);
+        if (endsWith_String(path, ".tmp")) {
+            remove(cstr_String(path));
+        }
+        else if (endsWith_String(path, ".bin")) {
+            const uint64_t blob = strtoull(baseName_Path(path).start, NULL, 16);
+            if (!contains_SortedArray(&refs, &blob)) {
+                remove(cstr_String(path));
+            }
+        }
+    }
+    deinit_SortedArray(&refs);
+}
+
+void init_GmCache(iGmCache *d, const char *dir) {
+    init_Mutex(&d->mtx);
+    initCStr_String(&d->dir, dir);
+    init_SortedArray(&d->entries, sizeof(iGmCacheEntry), cmp_GmCacheEntry_);
+    d->totalSize = 0;
+    d->maxSize   = 10000000;
+    d->numHits   = 0;
+    d->numMisses = 0;
+    makeDirs_Path(&d->dir);
+    load_GmCache_(d);
+    sweep_GmCache_(d);
+}
+
+void deinit_GmCache(iGmCache *d) {
+    iForEach(Array, i, &d->entries.values) {
+        deinit_GmCacheEntry_(i.value);
+    }
+    deinit_SortedArray(&d->entries);
+    deinit_String(&d->dir);
+    deinit_Mutex(&d->mtx);
+}
+
+void setMaxSize_GmCache(iGmCache *d, size_t maxSize) {
+    lock_Mutex(&d->mtx);
+    d->maxSize = maxSize;
+    evict_GmCache_(d);
+    unlock_Mutex(&d->mtx);
+}
+
+void save_GmCache(const iGmCache *d) {
+    iGmCache *cache = iConstCast(iGmCache *, d);
+    lock_Mutex(&cache->mtx);
+    /* The index is written under a temporary name so a partial write never replaces it. */
+    const char *path     = concatPath_CStr(cstr_String(&d->dir), indexFileName_GmCache_);
+    const char *tempPath = cstr_String(collectNewFormat_String("%s.tmp", path));
+    iBool       ok       = iFalse;
+    iFile *f = newCStr_File(tempPath);
+    if (open_File(f, writeOnly_FileMode)) {
+        iStream *outs = stream_File(f);
+        writeData_File(f, magicIndex_GmCache_, 4);
+        writeU32_File(f, latest_GmCacheIndexVersion);
+        writeU32_Stream(outs, size_SortedArray(&d->entries));
+        iConstForEach(Array, i, &d->entries.values) {
+            const iGmCacheEntry *entry = i.value;
+            serialize_String(&entry->url, outs);
+            writeU64_Stream(outs, entry->blob);
+            writeU64_Stream(outs, entry->size);
+            write32_Stream(outs, entry->statusCode);
+            serialize_String(&entry->meta, outs);
+            write32_Stream(outs, entry->certFlags);
+            writeU64_Stream(outs, entry->when.ts.tv_sec);
+            writeU64_Stream(outs, entry->lastUsed.ts.tv_sec);
+        }
+        close_File(f);
+#if defined (iPlatformMsys)
+        remove(path); /* rename() does not replace an existing file */
+#endif
+        ok = rename(tempPath, path) == 0;
+    }
+    iRelease(f);
+    if (!ok) {
+        remove(tempPath);
+    }
+    unlock_Mutex(&cache->mtx);
+}
+
+static size_t find_GmCache_(const iGmCache *d, const iString *url) {
+    iGmCacheEntry key = { .urlHash = urlHash_(url) };
+    key.url = *url; /* only compared */
+    size_t pos;
+    return locate_SortedArray(&d->entries, &key, &pos) ? pos : iInvalidPos;
+}
+
+static iBool writeBlob_GmCache_(const iGmCache *d, uint64_t blob, const iGmBody *body) {
+    const char *path = blobPath_GmCache_(d, blob);
+    if (fileExistsCStr_FileInfo(path)) {
+        return iTrue; /* same content is already stored */
+    }
+    /* Written under a temporary name so a partial blob is never mistaken for a complete one. */
+    const char *tempPath = cstr_String(collectNewFormat_String("%s.tmp", path));
+    iBool ok = iFalse;
+    iFile *f = newCStr_File(tempPath);
+    if (open_File(f, writeOnly_FileMode)) {
+        iGmBodyReader reader;
+        init_GmBodyReader(&reader);
+        iRangecc data;
+        ok = iTrue;
+        while (ok && readNext_GmBodyReader(&reader, body, &data)) {
+            ok = writeData_File(f, data.start, size_Range(&data)) == size_Range(&data);
+        }
+        deinit_GmBodyReader(&reader);
+        close_File(f);
+    }
+    iRelease(f);
+    if (ok) {
+        ok = rename(tempPath, path) == 0;
+    }
+    if (!ok) {
+        remove(tempPath);
+    }
+    return ok;
+}
+
+iBool store_GmCache(iGmCache *d, const iString *url, const iGmResponse *response) {
+    if (category_GmStatusCode(response->statusCode) != categorySuccess_GmStatusCode ||
+        sink_GmBody(&response->body) || size_GmBody(&response->body) > d->maxSize) {
+        return iFalse;
+    }
+    iBool isStored = iFalse;
+    lock_Mutex(&d->mtx);
+    const size_t oldPos = find_GmCache_(d, url);
+    if (oldPos != iInvalidPos) {
+        iGmCacheEntry *old = at_SortedArray(&d->entries, oldPos);
+        if (old->size == size_GmBody(&response->body) &&
+            integralSeconds_Time(&old->when) == integralSeconds_Time(&response->when)) {
+            /* Same response has already been stored. */
+            initCurrent_Time(&old->lastUsed);
+            unlock_Mutex(&d->mtx);
+            return iTrue;
+        }
+        removeAt_GmCache_(d, oldPos);
+    }
+    const uint64_t blob = contentHash_(&response->body);
+    if (writeBlob_GmCache_(d, blob, &response->body)) {
+        iGmCacheEntry entry;
+        initCopy_String(&entry.url, url);
+        entry.urlHash    = urlHash_(url);
+        entry.blob       = blob;
+        entry.size       = size_GmBody(&response->body);
+        entry.statusCode = response->statusCode;
+        initCopy_String(&entry.meta, &response->meta);
+        entry.certFlags  = response->certFlags;
+        entry.when       = response->when;
+        initCurrent_Time(&entry.lastUsed);
+        if (numBlobRefs_GmCache_(d, blob) == 0) {
+            d->totalSize += entry.size;
+        }
+        insert_SortedArray(&d->entries, &entry);
+        evict_GmCache_(d);
+        isStored = (find_GmCache_(d, url) != iInvalidPos);
+    }
+    unlock_Mutex(&d->mtx);
+    return isStored;
+}
+
+iBool contains_GmCache(const iGmCache *d, const iString *url, size_t size, const iTime *when) {
+    iGmCache *cache = iConstCast(iGmCache *, d);
+    iBool isContained = iFalse;
+    lock_Mutex(&cache->mtx);
+    const size_t pos = find_GmCache_(d, url);
+    if (pos != iInvalidPos) {
+        const iGmCacheEntry *entry = constAt_SortedArray(&d->entries, pos);
+        isContained = (entry->size == size &&
+                       integralSeconds_Time(&entry->when) == integralSeconds_Time(when));
+    }
+    unlock_Mutex(&cache->mtx);
+    return isContained;
+}
+
+iGmResponse *load_GmCache(iGmCache *d, const iString *url) {
+    iGmResponse *resp = NULL;
+    lock_Mutex(&d->mtx);
+    const size_t pos = find_GmCache_(d, url);
+    if (pos != iInvalidPos) {
+        iGmCacheEntry *entry = at_SortedArray(&d->entries, pos);
+        iFile *f = newCStr_File(blobPath_GmCache_(d, entry->blob));
+        if (open_File(f, readOnly_FileMode)) {
+            iBlock *data = readAll_File(f);
+            if (size_Block(data) == entry->size) {
+                resp = new_GmResponse();
+                resp->statusCode = entry->statusCode;
+                set_String(&resp->meta, &entry->meta);
+                set_GmBody(&resp->body, data);
+                resp->certFlags = entry->certFlags;
+                resp->when      = entry->when;
+                initCurrent_Time(&entry->lastUsed);
+            }
+            delete_Block(data);
+        }
+        iRelease(f);
+        if (!resp) {
+            removeAt_GmCache_(d, pos); /* blob is missing or damaged */
+        }
+    }
+    if (resp) {
+        d->numHits++;
+    }
+    else {
+        d->numMisses++;
+    }
+    unlock_Mutex(&d->mtx);
+    return resp;
+}
+
+void remove_GmCache(iGmCache *d, const iString *url) {
+    lock_Mutex(&d->mtx);
+    const size_t pos = find_GmCache_(d, url);
+    if (pos != iInvalidPos) {
+        removeAt_GmCache_(d, pos);
+    }
+    unlock_Mutex(&d->mtx);
+}
+
+void clear_GmCache(iGmCache *d) {
+    lock_Mutex(&d->mtx);
+    while (!isEmpty_SortedArray(&d->entries)) {
+        removeAt_GmCache_(d, size_SortedArray(&d->entries) - 1);
+    }
+    iAssert(d->totalSize == 0);
+    unlock_Mutex(&d->mtx);
+}
+
+size_t size_GmCache(const iGmCache *d) {
+    return d->totalSize;
+}
+
+const iString *debugInfo_GmCache(const iGmCache *d) {
+    iString *msg = collectNew_String();
+    appendFormat_String(msg, "* Directory: %s\n", cstr_String(&d->dir));
+    appendFormat_String(msg, "* Entries: %zu\n", size_SortedArray(&d->entries));
+    appendFormat_String(msg, "* Size: %.3f MB (limit %.3f MB)\n",
+                        d->totalSize / 1.0e6, d->maxSize / 1.0e6);
+    appendFormat_String(msg, "* Hits: %zu, misses: %zu\n", d->numHits, d->numMisses);
+    return msg;
+}
@@ -0,0 +1,46 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#pragma once
+
+#include <the_Foundation/string.h>
+#include <the_Foundation/time.h>
+
+/* Persistent cache of successful responses. Bodies are stored as content-addressed blob files
+   (identical bodies are kept only once), and a compact index maps URLs to the blobs. The least
+   recently used entries are evicted when the total size exceeds the limit. */
+
+iDeclareType(GmCache)
+iDeclareType(GmResponse)
+iDeclareTypeConstructionArgs(GmCache, const char *dir)
+
+void            setMaxSize_GmCache  (iGmCache *, size_t maxSize); /* bytes */
+void            save_GmCache        (const iGmCache *); /* writes the index */
+iBool           store_GmCache       (iGmCache *, const iString *url, const iGmResponse *response);
+iGmResponse *   load_GmCache        (iGmCache *, const iString *url); /* NULL if not cached */
+iBool           contains_GmCache    (const iGmCache *, const iString *url, size_t size, const iTime *when);
+void            remove_GmCache      (iGmCache *, const iString *url);
+void            clear_GmCache       (iGmCache *);
+
+size_t          size_GmCache        (const iGmCache *);
+const iString * debugInfo_GmCache   (const iGmCache *);
@@ -37,6 +37,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/stringset.h>
 
 #include <ctype.h>
+#include <string.h>
 
 iBool isDark_GmDocumentTheme(enum iGmDocumentTheme d) {
     if (d == gray_GmDocumentTheme) {
@@ -72,6 +73,28 @@ iDefineTypeConstruction(GmLink)
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(GmLayoutCheckpoint)
+
+struct Impl_GmLayoutCheckpoint {
+    /* Layout state at the start of a source line. Everything before the line is complete, so
+       layout can resume here when more source is appended. */
+    size_t           sourcePos; /* zero if there is nothing to resume */
+    size_t           numRuns;
+    size_t           numLinks;
+    size_t           numHeadings;
+    size_t           numPreMeta;
+    iBool            hasTitle;
+    iInt2            pos;
+    iBool            isFirstText;
+    iBool            addQuoteIcon;
+    iBool            enableIndents;
+    iBool            addSiteBanner;
+    iBool            followsBlank;
+    uint16_t         preId;
+    enum iGmLineType prevType;
+    enum iGmLineType prevNonBlankType;
+};
+
 struct Impl_GmDocument {
     iObject object;
     enum iGmDocumentFormat format;
@@ -80,6 +103,8 @@ struct Impl_GmDocument {
     iString   localHost;
     iInt2     size;
     iArray    layout; /* contents of source, laid out in document space */
+    iArray    runIndexY; /* indices of non-decoration runs in layout, in vertical order */
+    iArray    runIndexSource; /* indices of runs with text in source, in source order */
     iPtrArray links;
     enum iGmDocumentBanner bannerType;
     iString   bannerText;
@@ -90,6 +115,12 @@ struct Impl_GmDocument {
     iChar     siteIcon;
     iMedia *  media;
     iStringSet *openURLs; /* currently open URLs for highlighting links */
+    iBool     isLayoutCopy; /* laid out in a background thread; must not access UI state */
+    size_t    rawStableSize; /* complete lines of the unnormalized source already in `source` */
+    uint64_t  rawStableHash; /* hash of the unnormalized complete lines */
+    size_t    stableSize; /* size of the complete lines in `source` */
+    iBool     isStablePreformat; /* normalization state at the end of the complete lines */
+    iGmLayoutCheckpoint checkpoint; /* latest point where layout can be resumed */
 };
 
 iDefineObjectConstruction(GmDocument)
@@ -357,7 +388,54 @@ static void updateOpenURLs_GmDocument_(iGmDocument *d) {
     d->openURLs = listOpenURLs_App();
 }
 
-static void doLayout_GmDocument_(iGmDocument *d) {
+static void truncateRunIndex_GmDocument_(iArray *runIndex, size_t numRuns) {
+    while (!isEmpty_Array(runIndex) && *(const size_t *) back_Array(runIndex) >= numRuns) {
+        popBack_Array(runIndex);
+    }
+}
+
+static void updateRunIndex_GmDocument_(iGmDocument *d, size_t firstRun) {
+    /* Hit testing only looks at non-decoration runs. These are laid out top to bottom in
+       source order, so both lookups can be done with a binary search. */
+    truncateRunIndex_GmDocument_(&d->runIndexY, firstRun);
+    truncateRunIndex_GmDocument_(&d->runIndexSource, firstRun);
+    const char *srcStart = constBegin_String(&d->source);
+    const char *srcEnd   = constEnd_String(&d->source);
+    for (size_t index = firstRun; index < size_Array(&d->layout); index++) {
+        const iGmRun *run = constAt_Array(&d->layout, index);
+        if (run->flags & decoration_GmRunFlag) {
+            continue;
+        }
+        pushBack_Array(&d->runIndexY, &index);
+        if (run->text.start && run->text.start >= srcStart && run->text.end <= srcEnd) {
+            pushBack_Array(&d->runIndexSource, &index);
+        }
+    }
+}
+
+static const iGmRun *indexedRun_GmDocument_(const iGmDocument *d, const iArray *index,
+                                            size_t pos) {
+    return constAt_Array(&d->layout, constValue_Array(index, pos, size_t));
+}
+
+static void truncateLayout_GmDocument_(iGmDocument *d, const iGmLayoutCheckpoint *cp) {
+    resize_Array(&d->layout, cp->numRuns);
+    while (size_PtrArray(&d->links) > cp->numLinks) {
+        iGmLink *link = NULL;
+        take_PtrArray(&d->links, size_PtrArray(&d->links) - 1, (void **) &link);
+        delete_GmLink(link);
+    }
+    resize_Array(&d->headings, cp->numHeadings);
+    resize_Array(&d->preMeta, cp->numPreMeta);
+    if (!cp->hasTitle) {
+        clear_String(&d->title);
+    }
+    if (cp->addSiteBanner) {
+        clear_String(&d->bannerText);
+    }
+}
+
+static void doLayout_GmDocument_(iGmDocument *d, const iGmLayoutCheckpoint *resume) {
     const iPrefs *prefs             = prefs_App();
     const iBool   isMono            = isForcedMonospace_GmDocument_(d);
     const iBool   isNarrow          = d->size.x < 90 * gap_Text;
@@ -412,17 +490,29 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     static const char *quote           = "\u201c";
     static const char *magnifyingGlass = "\U0001f50d";
     static const char *pointingFinger  = "\U0001f449";
-    clear_Array(&d->layout);
-    clearLinks_GmDocument_(d);
-    clear_Array(&d->headings);
     const iArray *oldPreMeta = collect_Array(copy_Array(&d->preMeta)); /* remember fold states */
-    clear_Array(&d->preMeta);
-    clear_String(&d->title);
-    clear_String(&d->bannerText);
+    if (resume && resume->sourcePos > 0) {
+        /* Keep everything laid out before the checkpoint. */
+        truncateLayout_GmDocument_(d, resume);
+    }
+    else {
+        resume = NULL;
+        clear_Array(&d->layout);
+        clearLinks_GmDocument_(d);
+        clear_Array(&d->headings);
+        clear_Array(&d->preMeta);
+        clear_String(&d->title);
+        clear_String(&d->bannerText);
+    }
+    const size_t firstRun = size_Array(&d->layout);
+    iZap(d->checkpoint);
     if (d->size.x <= 0 || isEmpty_String(&d->source)) {
+        updateRunIndex_GmDocument_(d, 0);
         return;
     }
-    updateOpenURLs_GmDocument_(d);
+    if (!d->isLayoutCopy) {
+        updateOpenURLs_GmDocument_(d);
+    }
     const iRangecc   content       = range_String(&d->source);
     iRangecc         contentLine   = iNullRange;
     iInt2            pos           = zero_I2();
@@ -441,8 +531,45 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         isPreformat = iTrue;
         isFirstText = iFalse;
     }
+    if (resume) {
+        /* Continue after the end of the previous line. */
+        contentLine      = (iRangecc){ content.start + resume->sourcePos - 1,
+                                       content.start + resume->sourcePos - 1 };
+        pos              = resume->pos;
+        isFirstText      = resume->isFirstText;
+        addQuoteIcon     = resume->addQuoteIcon;
+        enableIndents    = resume->enableIndents;
+        addSiteBanner    = resume->addSiteBanner;
+        followsBlank     = resume->followsBlank;
+        preId            = resume->preId;
+        prevType         = resume->prevType;
+        prevNonBlankType = resume->prevNonBlankType;
+    }
     while (nextSplit_Rangecc(content, "\n", &contentLine)) {
         iRangecc line = contentLine; /* `line` will be trimmed later; would confuse nextSplit */
+        /* Layout can be resumed from the start of any complete line outside preformatted
+           blocks, because the block's font depends on all of its contents. */
+        if ((!isPreformat || d->format == plainText_GmDocumentFormat) &&
+            contentLine.start > content.start &&
+            (size_t) (contentLine.start - content.start) <= d->stableSize) {
+            d->checkpoint = (iGmLayoutCheckpoint){
+                .sourcePos        = contentLine.start - content.start,
+                .numRuns          = size_Array(&d->layout),
+                .numLinks         = size_PtrArray(&d->links),
+                .numHeadings      = size_Array(&d->headings),
+                .numPreMeta       = size_Array(&d->preMeta),
+                .hasTitle         = !isEmpty_String(&d->title),
+                .pos              = pos,
+                .isFirstText      = isFirstText,
+                .addQuoteIcon     = addQuoteIcon,
+                .enableIndents    = enableIndents,
+                .addSiteBanner    = addSiteBanner,
+                .followsBlank     = followsBlank,
+                .preId            = preId,
+                .prevType         = prevType,
+                .prevNonBlankType = prevNonBlankType,
+            };
+        }
         iGmRun run = { .color = white_ColorId };
         enum iGmLineType type;
         float indent = 0.0f;
@@ -850,18 +977,20 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     d->size.y = pos.y;
     /* Go over the preformatted blocks and mark them wide if at least one run is wide. */ {
         /* TODO: Store the dimensions and ranges for later access. */
-        iForEach(Array, i, &d->layout) {
-            iGmRun *run = i.value;
+        /* Blocks before the checkpoint were already marked. */
+        for (size_t i = firstRun; i < size_Array(&d->layout); i++) {
+            iGmRun *run = at_Array(&d->layout, i);
             if (run->preId && run->flags & wide_GmRunFlag) {
                 iGmRunRange block = findPreformattedRange_GmDocument(d, run);
                 for (const iGmRun *j = block.start; j != block.end; j++) {
                     iConstCast(iGmRun *, j)->flags |= wide_GmRunFlag;
                 }
                 /* Skip to the end of the block. */
-                i.pos = block.end - (const iGmRun *) constData_Array(&d->layout) - 1;
+                i = block.end - (const iGmRun *) constData_Array(&d->layout) - 1;
             }
         }
     }
+    updateRunIndex_GmDocument_(d, firstRun);
 }
 
 void init_GmDocument(iGmDocument *d) {
@@ -872,6 +1001,8 @@ void init_GmDocument(iGmDocument *d) {
     d->bannerType = siteDomain_GmDocumentBanner;
     d->size = zero_I2();
     init_Array(&d->layout, sizeof(iGmRun));
+    init_Array(&d->runIndexY, sizeof(size_t));
+    init_Array(&d->runIndexSource, sizeof(size_t));
     init_PtrArray(&d->links);
     init_String(&d->bannerText);
     init_String(&d->title);
@@ -881,6 +1012,12 @@ void init_GmDocument(iGmDocument *d) {
     d->siteIcon = 0;
     d->media = new_Media();
     d->openURLs = NULL;
+    d->isLayoutCopy = iFalse;
+    d->rawStableSize = 0;
+    d->rawStableHash = initial64_Hash;
+    d->stableSize = 0;
+    d->isStablePreformat = iFalse;
+    iZap(d->checkpoint);
 }
 
 void deinit_GmDocument(iGmDocument *d) {
@@ -892,6 +1029,8 @@ void deinit_GmDocument(iGmDocument *d) {
     deinit_PtrArray(&d->links);
     deinit_Array(&d->preMeta);
     deinit_Array(&d->headings);
+    deinit_Array(&d->runIndexSource);
+    deinit_Array(&d->runIndexY);
     deinit_Array(&d->layout);
     deinit_String(&d->localHost);
     deinit_String(&d->url);
@@ -906,15 +1045,69 @@ const iMedia *constMedia_GmDocument(const iGmDocument *d) {
     return d->media;
 }
 
+iGmDocument *newLayoutCopy_GmDocument(const iGmDocument *d) {
+    iGmDocument *copy = new_GmDocument();
+    copy->isLayoutCopy = iTrue;
+    setCopy_Array(&copy->preMeta, &d->preMeta); /* fold states */
+    updateLayoutCopy_GmDocument(copy, d);
+    return copy;
+}
+
+void updateLayoutCopy_GmDocument(iGmDocument *d, const iGmDocument *orig) {
+    iAssert(d->isLayoutCopy);
+    d->format     = orig->format;
+    d->bannerType = orig->bannerType;
+    d->themeSeed  = orig->themeSeed;
+    d->siteIcon   = orig->siteIcon;
+    set_String(&d->url, &orig->url);
+    set_String(&d->localHost, &orig->localHost);
+    iReleasePtr(&d->openURLs);
+    d->openURLs = orig->openURLs ? ref_Object(orig->openURLs) : new_StringSet();
+    /* Fold states may have changed since the previous layout. */
+    const size_t numCommon = iMin(size_Array(&d->preMeta), size_Array(&orig->preMeta));
+    iBool isFoldChanged = iFalse;
+    for (size_t i = 0; !isFoldChanged && i < numCommon; i++) {
+        isFoldChanged = (((const iGmPreMeta *) constAt_Array(&d->preMeta, i))->flags ^
+                         ((const iGmPreMeta *) constAt_Array(&orig->preMeta, i))->flags) &
+                        folded_GmPreMetaFlag;
+    }
+    if (isFoldChanged) {
+        setCopy_Array(&d->preMeta, &orig->preMeta);
+        iZap(d->checkpoint); /* lay out everything again */
+    }
+}
+
+void takeLayout_GmDocument(iGmDocument *d, iGmDocument *laidOut) {
+    /* Runs refer to the source and links of `laidOut`, so everything is swapped at once. */
+    iSwap(iString,   d->source,         laidOut->source);
+    iSwap(iInt2,     d->size,           laidOut->size);
+    iSwap(iArray,    d->layout,         laidOut->layout);
+    iSwap(iArray,    d->runIndexY,      laidOut->runIndexY);
+    iSwap(iArray,    d->runIndexSource, laidOut->runIndexSource);
+    iSwap(iPtrArray, d->links,          laidOut->links);
+    iSwap(iString,   d->bannerText,     laidOut->bannerText);
+    iSwap(iString,   d->title,          laidOut->title);
+    iSwap(iArray,    d->headings,       laidOut->headings);
+    iSwap(iArray,    d->preMeta,        laidOut->preMeta);
+    iSwap(size_t,    d->rawStableSize,  laidOut->rawStableSize);
+    iSwap(uint64_t,  d->rawStableHash,  laidOut->rawStableHash);
+    iSwap(size_t,    d->stableSize,     laidOut->stableSize);
+    iSwap(iBool,     d->isStablePreformat, laidOut->isStablePreformat);
+    iSwap(iGmLayoutCheckpoint, d->checkpoint, laidOut->checkpoint);
+}
+
 void reset_GmDocument(iGmDocument *d) {
     clear_Media(d->media);
     clearLinks_GmDocument_(d);
     clear_Array(&d->layout);
+    clear_Array(&d->runIndexY);
+    clear_Array(&d->runIndexSource);
     clear_Array(&d->headings);
     clear_Array(&d->preMeta);
     clear_String(&d->url);
     clear_String(&d->localHost);
     d->themeSeed = 0;
+    iZap(d->checkpoint);
 }
 
 static void setDerivedThemeColors_(enum iGmDocumentTheme theme) {
@@ -1400,11 +1593,11 @@ void setBanner_GmDocument(iGmDocument *d, enum iGmDocumentBanner type) {
 
 void setWidth_GmDocument(iGmDocument *d, int width) {
     d->size.x = width;
-    doLayout_GmDocument_(d); /* TODO: just flag need-layout and do it later */
+    doLayout_GmDocument_(d, NULL); /* TODO: just flag need-layout and do it later */
 }
 
 void redoLayout_GmDocument(iGmDocument *d) {
-    doLayout_GmDocument_(d);
+    doLayout_GmDocument_(d, NULL);
 }
 
 iBool updateOpenURLs_GmDocument(iGmDocument *d) {
@@ -1427,16 +1620,19 @@ iLocalDef iBool isNormalizableSpace_(char ch) {
     return ch == ' ' || ch == '\t';
 }
 
-static void normalize_GmDocument(iGmDocument *d) {
+static iBool normalize_GmDocument_(const iGmDocument *d, iRangecc src, iBool isPreformat,
+                                   iString *out) {
+    /* Appends the normalized lines of `src` to `out`. Returns the preformatted state after
+       the last line. */
     iString *normalized = new_String();
-    iRangecc src = range_String(&d->source);
-    iRangecc line = iNullRange;
-    iBool isPreformat = iFalse;
     if (d->format == plainText_GmDocumentFormat) {
         isPreformat = iTrue; /* Cannot be turned off. */
     }
     const int preTabWidth = 4; /* TODO: user-configurable parameter */
-    while (nextSplit_Rangecc(src, "\n", &line)) {
+    for (const char *lineStart = src.start; lineStart < src.end; ) {
+        const char    *lineEnd = memchr(lineStart, '\n', src.end - lineStart);
+        const iRangecc line    = { lineStart, lineEnd ? lineEnd : src.end };
+        lineStart = line.end + 1;
         if (isPreformat) {
             /* Replace any tab characters with spaces for visualization. */
             for (const char *ch = line.start; ch != line.end; ch++) {
@@ -1490,8 +1686,64 @@ static void normalize_GmDocument(iGmDocument *d) {
         }
         appendCStr_String(normalized, "\n");
     }
-    set_String(&d->source, collect_String(normalized));
-    normalize_String(&d->source); /* NFC */
+    normalize_String(normalized); /* NFC */
+    append_String(out, normalized);
+    delete_String(normalized);
+    return isPreformat;
+}
+
+static void appendSource_GmDocument_(iGmDocument *d, iRangecc src, iBool isComplete) {
+    if (isEmpty_Range(&src)) {
+        return;
+    }
+    if (isNormalized_GmDocument_(d)) {
+        const iBool isPreformat =
+            normalize_GmDocument_(d, src, d->isStablePreformat, &d->source);
+        if (isComplete) {
+            d->isStablePreformat = isPreformat;
+        }
+    }
+    else {
+        appendRange_String(&d->source, src);
+    }
+    if (isComplete) {
+        d->rawStableSize += size_Range(&src);
+        d->rawStableHash = hash64_Data(d->rawStableHash, src.start, size_Range(&src));
+        d->stableSize = size_String(&d->source);
+    }
+}
+
+static void rebaseRange_(iRangecc *range, const char *oldStart, const char *oldEnd,
+                         const char *newStart) {
+    if (range->start >= oldStart && range->end <= oldEnd) {
+        range->start = newStart + (range->start - oldStart);
+        range->end   = newStart + (range->end - oldStart);
+    }
+}
+
+static void rebaseSource_GmDocument_(iGmDocument *d, const char *oldStart, const char *oldEnd) {
+    /* The source buffer was reallocated. Ranges into the old buffer are moved to the new one. */
+    const char *newStart = constBegin_String(&d->source);
+    iForEach(Array, i, &d->layout) {
+        iGmRun *run = i.value;
+        rebaseRange_(&run->text, oldStart, oldEnd, newStart);
+    }
+    iForEach(PtrArray, j, &d->links) {
+        iGmLink *link = j.ptr;
+        rebaseRange_(&link->urlRange, oldStart, oldEnd, newStart);
+        rebaseRange_(&link->labelRange, oldStart, oldEnd, newStart);
+        rebaseRange_(&link->labelIcon, oldStart, oldEnd, newStart);
+    }
+    iForEach(Array, h, &d->headings) {
+        iGmHeading *head = h.value;
+        rebaseRange_(&head->text, oldStart, oldEnd, newStart);
+    }
+    iForEach(Array, p, &d->preMeta) {
+        iGmPreMeta *meta = p.value;
+        rebaseRange_(&meta->bounds, oldStart, oldEnd, newStart);
+        rebaseRange_(&meta->altText, oldStart, oldEnd, newStart);
+        rebaseRange_(&meta->contents, oldStart, oldEnd, newStart);
+    }
 }
 
 void setUrl_GmDocument(iGmDocument *d, const iString *url) {
@@ -1502,12 +1754,52 @@ void setUrl_GmDocument(iGmDocument *d, const iString *url) {
     updateIconBasedOnUrl_GmDocument_(d);
 }
 
-void setSource_GmDocument(iGmDocument *d, const iString *source, int width) {
-    set_String(&d->source, source);
-    if (isNormalized_GmDocument_(d)) {
-        normalize_GmDocument(d);
+void setSource_GmDocument(iGmDocument *d, const iString *source, int width,
+                          enum iGmDocumentUpdate updateType) {
+    /* The new source must begin with the lines that have already been laid out. */
+    const iBool isAppend =
+        updateType == append_GmDocumentUpdate && d->checkpoint.sourcePos > 0 &&
+        d->size.x == width && d->rawStableSize <= size_String(source) &&
+        hash64_Data(initial64_Hash, constBegin_String(source), d->rawStableSize) ==
+            d->rawStableHash;
+    const char *oldStart = constBegin_String(&d->source);
+    const char *oldEnd   = constEnd_String(&d->source);
+    if (isAppend) {
+        /* Only the lines after the complete ones need to be processed. The last line may be
+           incomplete, so it is redone when more source arrives. */
+        truncate_Block(&d->source.chars, d->stableSize);
+    }
+    else {
+        clear_String(&d->source);
+        d->rawStableSize     = 0;
+        d->rawStableHash     = initial64_Hash;
+        d->stableSize        = 0;
+        d->isStablePreformat = iFalse;
+    }
+    const iRangecc src = { constBegin_String(source) + d->rawStableSize, constEnd_String(source) };
+    const char *completeEnd = src.end;
+    if (updateType == append_GmDocumentUpdate) {
+        while (completeEnd > src.start && completeEnd[-1] != '\n') {
+            completeEnd--;
+        }
+    }
+    appendSource_GmDocument_(d, (iRangecc){ src.start, completeEnd }, iTrue);
+    appendSource_GmDocument_(d, (iRangecc){ completeEnd, src.end }, iFalse);
+    if (!isAppend && equal_String(&d->source, source)) {
+        /* Normalization didn't change anything, so share the caller's buffer instead of
+           keeping a second copy of the page. Nothing refers to the source yet. */
+        set_String(&d->source, source);
+    }
+    if (isAppend) {
+        if (constBegin_String(&d->source) != oldStart) {
+            rebaseSource_GmDocument_(d, oldStart, oldEnd);
+        }
+        const iGmLayoutCheckpoint resume = d->checkpoint;
+        doLayout_GmDocument_(d, &resume);
+    }
+    else {
+        setWidth_GmDocument(d, width); /* re-do layout */
     }
-    setWidth_GmDocument(d, width); /* re-do layout */
 }
 
 void foldPre_GmDocument(iGmDocument *d, uint16_t preId) {
@@ -1647,30 +1939,33 @@ iGmRunRange findPreformattedRange_GmDocument(const iGmDocument *d, const iGmRun
 }
 
 const iGmRun *findRun_GmDocument(const iGmDocument *d, iInt2 pos) {
-    /* TODO: Perf optimization likely needed; use a block map? */
-    const iGmRun *last = NULL;
-    iBool isFirstNonDecoration = iTrue;
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
-        if (run->flags & decoration_GmRunFlag) continue;
-        const iRangei span = ySpan_Rect(run->bounds);
-        if (contains_Range(&span, pos.y)) {
-            last = run;
-            break;
+    const iArray *index = &d->runIndexY;
+    if (isEmpty_Array(index)) {
+        return NULL;
+    }
+    /* Find the first run that begins below the point. */
+    size_t lo = 0, hi = size_Array(index);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (top_Rect(indexedRun_GmDocument_(d, index, mid)->bounds) > pos.y) {
+            hi = mid;
         }
-        if (isFirstNonDecoration && pos.y < top_Rect(run->bounds)) {
-            last = run;
-            break;
+        else {
+            lo = mid + 1;
         }
-        if (top_Rect(run->bounds) > pos.y) break; /* Below the point. */
-        last = run;
-        isFirstNonDecoration = iFalse;
     }
-//    if (last) {
-//        printf("found run at (%d,%d): %p [%s]\n", pos.x, pos.y, last, cstr_Rangecc(last->text));
-//        fflush(stdout);
-//    }
-    return last;
+    if (lo == 0) {
+        return indexedRun_GmDocument_(d, index, 0); /* above the first run */
+    }
+    /* The preceding run is the closest one. Runs may overlap slightly (e.g., tightly set
+       headings), in which case the earliest run containing the point is chosen. */
+    size_t found = lo - 1;
+    while (found > 0) {
+        const iRangei span = ySpan_Rect(indexedRun_GmDocument_(d, index, found - 1)->bounds);
+        if (!contains_Range(&span, pos.y)) break;
+        found--;
+    }
+    return indexedRun_GmDocument_(d, index, found);
 }
 
 iRangecc findLoc_GmDocument(const iGmDocument *d, iInt2 pos) {
@@ -1682,16 +1977,19 @@ iRangecc findLoc_GmDocument(const iGmDocument *d, iInt2 pos) {
 }
 
 const iGmRun *findRunAtLoc_GmDocument(const iGmDocument *d, const char *textCStr) {
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
-        if (run->flags & decoration_GmRunFlag) {
-            continue;
+    /* Find the first run that contains or is past the location. */
+    const iArray *index = &d->runIndexSource;
+    size_t lo = 0, hi = size_Array(index);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (indexedRun_GmDocument_(d, index, mid)->text.end > textCStr) {
+            hi = mid;
         }
-        if (contains_Range(&run->text, textCStr) || run->text.start > textCStr /* went past */) {
-            return run;
+        else {
+            lo = mid + 1;
         }
     }
-    return NULL;
+    return lo < size_Array(index) ? indexedRun_GmDocument_(d, index, lo) : NULL;
 }
 
 static const iGmLink *link_GmDocument_(const iGmDocument *d, iGmLinkId id) {
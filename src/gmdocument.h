@@ -160,6 +160,11 @@ enum iGmDocumentBanner {
     certificateWarning_GmDocumentBanner,
 };
 
+enum iGmDocumentUpdate {
+    replace_GmDocumentUpdate, /* source is unrelated to the previous one */
+    append_GmDocumentUpdate,  /* previous source continues; layout resumes after its complete lines */
+};
+
 void    setThemeSeed_GmDocument (iGmDocument *, const iBlock *seed);
 void    setFormat_GmDocument    (iGmDocument *, enum iGmDocumentFormat format);
 void    setBanner_GmDocument    (iGmDocument *, enum iGmDocumentBanner type);
@@ -167,11 +172,16 @@ void    setWidth_GmDocument     (iGmDocument *, int width);
 void    redoLayout_GmDocument   (iGmDocument *);
 iBool   updateOpenURLs_GmDocument(iGmDocument *);
 void    setUrl_GmDocument       (iGmDocument *, const iString *url);
-void    setSource_GmDocument    (iGmDocument *, const iString *source, int width);
+void    setSource_GmDocument    (iGmDocument *, const iString *source, int width,
+                                 enum iGmDocumentUpdate updateType);
 void    foldPre_GmDocument      (iGmDocument *, uint16_t preId);
 
 void    reset_GmDocument        (iGmDocument *); /* free images */
 
+iGmDocument *   newLayoutCopy_GmDocument(const iGmDocument *); /* for laying out in the background */
+void            updateLayoutCopy_GmDocument(iGmDocument *, const iGmDocument *orig);
+void            takeLayout_GmDocument   (iGmDocument *, iGmDocument *laidOut);
+
 typedef void (*iGmDocumentRenderFunc)(void *, const iGmRun *);
 
 iMedia *        media_GmDocument            (iGmDocument *);
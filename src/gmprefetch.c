@@ -0,0 +1,203 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include "gmprefetch.h"
+#include "gmcache.h"
+#include "gmrequest.h"
+#include "app.h"
+
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/time.h>
+
+static const size_t maxSize_GmPrefetch_     = 256 * 1024; /* bytes */
+static const size_t maxResponses_GmPrefetch_ = 8;
+static const double maxAge_GmPrefetch_      = 120.0; /* seconds */
+
+iDeclareType(PrefetchedResponse)
+
+struct Impl_PrefetchedResponse {
+    iString      url;
+    iGmResponse *resp;
+    iTime        fetchedAt;
+};
+
+static void delete_PrefetchedResponse_(iPrefetchedResponse *d) {
+    deinit_String(&d->url);
+    delete_GmResponse(d->resp);
+    free(d);
+}
+
+struct Impl_GmPrefetch {
+    iGmRequest *request; /* in flight */
+    iPtrArray   responses; /* PrefetchedResponse *, oldest first */
+    size_t      numStarted;
+    size_t      numCancelled;
+    size_t      numFetched; /* kept for use */
+    size_t      numHits;
+};
+
+iDefineTypeConstruction(GmPrefetch)
+
+void init_GmPrefetch(iGmPrefetch *d) {
+    d->request = NULL;
+    init_PtrArray(&d->responses);
+    d->numStarted   = 0;
+    d->numCancelled = 0;
+    d->numFetched   = 0;
+    d->numHits      = 0;
+}
+
+void deinit_GmPrefetch(iGmPrefetch *d) {
+    iReleasePtr(&d->request);
+    iForEach(PtrArray, i, &d->responses) {
+        delete_PrefetchedResponse_(i.ptr);
+    }
+    deinit_PtrArray(&d->responses);
+}
+
+static void updated_GmPrefetch_(iAnyObject *obj, iGmRequest *req) {
+    iUnused(obj);
+    postCommandf_App("prefetch.updated reqid:%u", id_GmRequest(req));
+}
+
+static void finished_GmPrefetch_(iAnyObject *obj, iGmRequest *req) {
+    iUnused(obj);
+    postCommandf_App("prefetch.finished reqid:%u", id_GmRequest(req));
+}
+
+static iBool isKept_GmPrefetch_(const iGmResponse *resp) {
+    return resp->statusCode == success_GmStatusCode &&
+           startsWithCase_String(&resp->meta, "text/gemini") &&
+           size_GmBody(&resp->body) <= maxSize_GmPrefetch_;
+}
+
+static size_t find_GmPrefetch_(const iGmPrefetch *d, const iString *url) {
+    iConstForEach(PtrArray, i, &d->responses) {
+        const iPrefetchedResponse *pre = i.ptr;
+        if (equal_String(&pre->url, url)) {
+            return index_PtrArrayConstIterator(&i);
+        }
+    }
+    return iInvalidPos;
+}
+
+static void removeExpired_GmPrefetch_(iGmPrefetch *d) {
+    iForEach(PtrArray, i, &d->responses) {
+        iPrefetchedResponse *pre = i.ptr;
+        if (elapsedSeconds_Time(&pre->fetchedAt) > maxAge_GmPrefetch_) {
+            delete_PrefetchedResponse_(pre);
+            remove_PtrArrayIterator(&i);
+        }
+    }
+}
+
+void start_GmPrefetch(iGmPrefetch *d, const iString *url) {
+    removeExpired_GmPrefetch_(d);
+    if (find_GmPrefetch_(d, url) != iInvalidPos ||
+        (d->request && equal_String(url_GmRequest(d->request), url))) {
+        return; /* already have it */
+    }
+    if (d->request) {
+        cancel_GmPrefetch(d, url_GmRequest(d->request));
+    }
+    d->request = new_GmRequest(certs_App());
+    setUrl_GmRequest(d->request, url);
+    setPriority_GmRequest(d->request, background_GmRequestPriority);
+    iConnect(GmRequest, d->request, updated, d, updated_GmPrefetch_);
+    iConnect(GmRequest, d->request, finished, d, finished_GmPrefetch_);
+    d->numStarted++;
+    submit_GmRequest(d->request);
+}
+
+void cancel_GmPrefetch(iGmPrefetch *d, const iString *url) {
+    if (d->request && !isFinished_GmRequest(d->request) &&
+        (!url || equal_String(url_GmRequest(d->request), url))) {
+        iDisconnect(GmRequest, d->request, updated, d, updated_GmPrefetch_);
+        iDisconnect(GmRequest, d->request, finished, d, finished_GmPrefetch_);
+        iReleasePtr(&d->request);
+        d->numCancelled++;
+    }
+}
+
+void requestUpdated_GmPrefetch(iGmPrefetch *d, uint32_t requestId) {
+    if (!d->request || id_GmRequest(d->request) != requestId) {
+        return; /* already cancelled */
+    }
+    /* Stop as soon as it's clear the response won't be kept. Unlocking the response allows
+       further updates to be notified. */
+    const iGmResponse *resp   = lockResponse_GmRequest(d->request);
+    const iBool        isKept = resp->statusCode == none_GmStatusCode || isKept_GmPrefetch_(resp);
+    unlockResponse_GmRequest(d->request);
+    if (!isKept) {
+        cancel_GmPrefetch(d, NULL);
+    }
+}
+
+void requestFinished_GmPrefetch(iGmPrefetch *d, uint32_t requestId) {
+    if (!d->request || id_GmRequest(d->request) != requestId) {
+        return; /* already cancelled */
+    }
+    iGmRequest *req = d->request;
+    iDisconnect(GmRequest, d->request, updated, d, updated_GmPrefetch_);
+    iDisconnect(GmRequest, d->request, finished, d, finished_GmPrefetch_);
+    const iGmResponse *resp = lockResponse_GmRequest(req);
+    if (isKept_GmPrefetch_(resp)) {
+        iPrefetchedResponse *pre = iMalloc(PrefetchedResponse);
+        initCopy_String(&pre->url, url_GmRequest(req));
+        pre->resp = copy_GmResponse(resp);
+        initCurrent_Time(&pre->fetchedAt);
+        pushBack_PtrArray(&d->responses, pre);
+        if (size_PtrArray(&d->responses) > maxResponses_GmPrefetch_) {
+            delete_PrefetchedResponse_(at_PtrArray(&d->responses, 0));
+            remove_Array(&d->responses, 0);
+        }
+        store_GmCache(cache_App(), &pre->url, pre->resp);
+        d->numFetched++;
+    }
+    unlockResponse_GmRequest(req);
+    iReleasePtr(&d->request);
+}
+
+iGmResponse *take_GmPrefetch(iGmPrefetch *d, const iString *url) {
+    removeExpired_GmPrefetch_(d);
+    const size_t pos = find_GmPrefetch_(d, url);
+    if (pos == iInvalidPos) {
+        return NULL;
+    }
+    iPrefetchedResponse *pre = at_PtrArray(&d->responses, pos);
+    iGmResponse *resp = pre->resp;
+    pre->resp = NULL;
+    delete_PrefetchedResponse_(pre);
+    remove_Array(&d->responses, pos);
+    d->numHits++;
+    return resp;
+}
+
+const iString *debugInfo_GmPrefetch(const iGmPrefetch *d) {
+    iString *msg = collectNew_String();
+    appendFormat_String(msg, "* Prefetches: %zu started, %zu cancelled, %zu kept\n",
+                        d->numStarted, d->numCancelled, d->numFetched);
+    appendFormat_String(msg, "* Hits: %zu (%.0f%% of kept)\n", d->numHits,
+                        d->numFetched ? 100.0 * d->numHits / d->numFetched : 0.0);
+    return msg;
+}
@@ -0,0 +1,42 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#pragma once
+
+#include <the_Foundation/string.h>
+
+/* Speculative fetching of links the user is likely to open next, e.g., when the mouse rests on
+   a link. Only small, successful text/gemini responses are kept, and only for a short while.
+   One prefetch is in flight at a time; it is cancelled when the user's intent changes. */
+
+iDeclareType(GmPrefetch)
+iDeclareType(GmResponse)
+iDeclareTypeConstruction(GmPrefetch)
+
+void            start_GmPrefetch            (iGmPrefetch *, const iString *url);
+void            cancel_GmPrefetch           (iGmPrefetch *, const iString *url); /* if in flight; NULL for any */
+void            requestUpdated_GmPrefetch   (iGmPrefetch *, uint32_t requestId);
+void            requestFinished_GmPrefetch  (iGmPrefetch *, uint32_t requestId);
+iGmResponse *   take_GmPrefetch             (iGmPrefetch *, const iString *url); /* NULL if not prefetched */
+
+const iString * debugInfo_GmPrefetch        (const iGmPrefetch *);
@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmrequest.h"
 #include "gmutil.h"
 #include "gmcerts.h"
+#include "gmscheduler.h"
 #include "gopher.h"
 #include "app.h" /* dataDir_App() */
 #include "mimehooks.h"
@@ -42,13 +43,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/tlsrequest.h>
 
 #include <SDL_timer.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#if defined (iPlatformMsys)
+#   include <io.h>
+#   include <sys/stat.h>
+#else
+#   include <unistd.h>
+#endif
 
 iDefineTypeConstruction(GmResponse)
 
 void init_GmResponse(iGmResponse *d) {
     d->statusCode = none_GmStatusCode;
     init_String(&d->meta);
-    init_Block(&d->body, 0);
+    init_GmBody(&d->body);
     d->certFlags = 0;
     init_Block(&d->certFingerprint, 0);
     iZap(d->certValidUntil);
@@ -59,7 +70,7 @@ void init_GmResponse(iGmResponse *d) {
 void initCopy_GmResponse(iGmResponse *d, const iGmResponse *other) {
     d->statusCode = other->statusCode;
     initCopy_String(&d->meta, &other->meta);
-    initCopy_Block(&d->body, &other->body);
+    initCopy_GmBody(&d->body, &other->body);
     d->certFlags = other->certFlags;
     initCopy_Block(&d->certFingerprint, &other->certFingerprint);
     d->certValidUntil = other->certValidUntil;
@@ -69,7 +80,7 @@ void initCopy_GmResponse(iGmResponse *d, const iGmResponse *other) {
 
 void deinit_GmResponse(iGmResponse *d) {
     deinit_String(&d->certSubject);
-    deinit_Block(&d->body);
+    deinit_GmBody(&d->body);
     deinit_Block(&d->certFingerprint);
     deinit_String(&d->meta);
 }
@@ -77,7 +88,7 @@ void deinit_GmResponse(iGmResponse *d) {
 void clear_GmResponse(iGmResponse *d) {
     d->statusCode = none_GmStatusCode;
     clear_String(&d->meta);
-    clear_Block(&d->body);
+    clear_GmBody(&d->body);
     d->certFlags = 0;
     clear_Block(&d->certFingerprint);
     iZap(d->certValidUntil);
@@ -94,7 +105,7 @@ iGmResponse *copy_GmResponse(const iGmResponse *d) {
 void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
     write32_Stream(outs, d->statusCode);
     serialize_String(&d->meta, outs);
-    serialize_Block(&d->body, outs);
+    serialize_GmBody(&d->body, outs);
     /* TODO: Add certificate fingerprint, but need to bump file version first. */
     write32_Stream(outs, d->certFlags & ~haveFingerprint_GmCertFlag);
     serialize_Date(&d->certValidUntil, outs);
@@ -105,7 +116,7 @@ void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
 void deserialize_GmResponse(iGmResponse *d, iStream *ins) {
     d->statusCode = read32_Stream(ins);
     deserialize_String(&d->meta, ins);
-    deserialize_Block(&d->body, ins);
+    deserialize_GmBody(&d->body, ins);
     d->certFlags = read32_Stream(ins);
     deserialize_Date(&d->certValidUntil, ins);
     deserialize_String(&d->certSubject, ins);
@@ -136,9 +147,13 @@ struct Impl_GmRequest {
     enum iGmRequestState state;
     iString              url;
     iTlsRequest *        req;
+    enum iGmRequestPriority priority;
     iGopher              gopher;
     iGmResponse *        resp;
     iBool                isFilterEnabled;
+    iString              downloadPath; /* non-displayable body is saved here */
+    iFile *              downloadFile; /* body is written here instead of memory */
+    iBool                isDownloading; /* `downloadFile` is open */
     iBool                isRespLocked;
     iBool                isRespFiltered;
     iAtomicInt           allowUpdate;
@@ -176,33 +191,133 @@ static void checkServerCertificate_GmRequest_(iGmRequest *d) {
     }
 }
 
+static iBool isDisplayable_(const iString *mime) {
+    /* These are shown as pages or inline media instead of being saved as files. */
+    return startsWithCase_String(mime, "text/") || startsWithCase_String(mime, "image/") ||
+           startsWithCase_String(mime, "audio/");
+}
+
+static iBool createNewFile_(const char *path) {
+    /* Fails with EEXIST if the file already exists. */
+#if defined (iPlatformMsys)
+    const int fd = _open(path, _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if (fd >= 0) {
+        _close(fd);
+    }
+#else
+    const int fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0666);
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+    return fd >= 0;
+}
+
+static iFile *createExclusive_GmRequest_(const iString *path) {
+    /* Other downloads may have chosen the same name, so the file is created only if it doesn't
+       exist yet. Otherwise, a number is added to the name. */
+    size_t insPos = lastIndexOfCStr_String(path, ".");
+    if (insPos == iInvalidPos || insPos < lastIndexOfCStr_String(path, "/")) {
+        insPos = size_String(path);
+    }
+    iString *unique = copy_String(path);
+    for (int counter = 2; ; counter++) {
+        if (createNewFile_(cstr_String(unique))) {
+            break;
+        }
+        if (errno != EEXIST || counter > 1000) {
+            delete_String(unique);
+            return NULL;
+        }
+        char num[16];
+        snprintf(num, sizeof(num), "-%d", counter);
+        set_String(unique, path);
+        insertData_Block(&unique->chars, insPos, num, strlen(num));
+    }
+    iFile *file = new_File(unique);
+    if (!open_File(file, writeOnly_FileMode)) {
+        remove(cstr_String(unique));
+        iReleasePtr(&file);
+    }
+    delete_String(unique);
+    return file;
+}
+
+static void beginDownload_GmRequest_(iGmRequest *d) {
+    iAssert(!d->downloadFile);
+    iFile *file = createExclusive_GmRequest_(&d->downloadPath);
+    if (!file) {
+        return; /* keep the body in memory, then */
+    }
+    d->downloadFile  = file;
+    d->isDownloading = iTrue;
+    setSink_GmBody(&d->resp->body, file);
+}
+
+static void endDownload_GmRequest_(iGmRequest *d, iBool isComplete) {
+    if (d->isDownloading) {
+        close_File(d->downloadFile);
+        d->isDownloading = iFalse;
+        if (!isComplete) {
+            /* Don't leave a truncated file in Downloads. */
+            remove(cstr_String(path_File(d->downloadFile)));
+        }
+    }
+}
+
+enum { maxHeaderSize_GmRequest_ = 2 + 1 + 1024 + 2 }; /* <STATUS><SPACE><META><CR><LF>, META is at most 1024 bytes */
+
+static const char *findLineEnd_(const char *pos, const char *end) {
+    for (; pos + 1 < end; pos++) {
+        if (pos[0] == '\r' && pos[1] == '\n') {
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+static int parseStatus_(iString *header) {
+    /* The status code is two digits, optionally followed by whitespace and the <META>. */
+    const char *line = constBegin_String(header);
+    if (size_String(header) < 2 || line[0] < '0' || line[0] > '9' || line[1] < '0' ||
+        line[1] > '9') {
+        return 0;
+    }
+    const int code = (line[0] - '0') * 10 + (line[1] - '0');
+    remove_Block(&header->chars, 0, 2);
+    trimStart_String(header);
+    return code;
+}
+
 static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
     iBool        notifyUpdate = iFalse;
     iBool        notifyDone   = iFalse;
     iGmResponse *resp         = d->resp;
     if (d->state == receivingHeader_GmRequestState) {
-        appendCStrN_String(&resp->meta, constData_Block(data), size_Block(data));
-        /* Check if the header line is complete. */
-        size_t endPos = indexOfCStr_String(&resp->meta, "\r\n");
-        if (endPos != iInvalidPos) {
-            /* Move remainder to the body. */
-            setData_Block(&resp->body,
-                          constBegin_String(&resp->meta) + endPos + 2,
-                          size_String(&resp->meta) - endPos - 2);
-            remove_Block(&resp->meta.chars, endPos, iInvalidSize);
-            /* Parse and remove the code. */
-            iRegExp *metaPattern = new_RegExp("^([0-9][0-9])(( )(.*))?", 0);
-            /* TODO: Empty <META> means no <SPACE>? Not according to the spec? */
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
+        /* The header is bounded, so only that much is kept in the meta string while looking
+           for the end of the line. Only the newly arrived bytes need to be checked. */
+        const size_t oldSize        = size_String(&resp->meta);
+        const size_t numHeaderBytes = iMin(size_Block(data),
+                                           maxHeaderSize_GmRequest_ -
+                                               iMin(oldSize, (size_t) maxHeaderSize_GmRequest_));
+        appendData_Block(&resp->meta.chars, constData_Block(data), numHeaderBytes);
+        const char *lineStart = constBegin_String(&resp->meta);
+        const char *lineEnd   = findLineEnd_(lineStart + (oldSize ? oldSize - 1 : 0),
+                                             constEnd_String(&resp->meta));
+        if (lineEnd || size_String(&resp->meta) >= maxHeaderSize_GmRequest_) {
             int code = 0;
-            if (matchString_RegExp(metaPattern, &resp->meta, &m)) {
-                code = atoi(capturedRange_RegExpMatch(&m, 1).start);
-                remove_Block(&resp->meta.chars,
-                             0,
-                             capturedRange_RegExpMatch(&m, 1).end -
-                                 constBegin_String(&resp->meta)); /* leave just the <META> */
-                trimStart_String(&resp->meta);
+            if (lineEnd) {
+                /* Move remainder to the body. */
+                const size_t endPos = lineEnd - lineStart;
+                setData_GmBody(&resp->body,
+                               lineStart + endPos + 2,
+                               size_String(&resp->meta) - endPos - 2);
+                appendData_GmBody(&resp->body,
+                                  constBegin_Block(data) + numHeaderBytes,
+                                  size_Block(data) - numHeaderBytes);
+                remove_Block(&resp->meta.chars, endPos, iInvalidSize);
+                /* TODO: Empty <META> means no <SPACE>? Not according to the spec? */
+                code = parseStatus_(&resp->meta); /* leaves just the <META> */
             }
             if (code == 0) {
                 clear_String(&resp->meta);
@@ -220,13 +335,17 @@ static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
                 if (d->isFilterEnabled && willTryFilter_MimeHooks(mimeHooks_App(), &resp->meta)) {
                     d->isRespFiltered = iTrue;
                 }
+                if (!isEmpty_String(&d->downloadPath) && !d->isRespFiltered && isSuccess_GmStatusCode(code) &&
+                    !isDisplayable_(&resp->meta)) {
+                    /* The rest of the body goes straight from the received data to the file. */
+                    beginDownload_GmRequest_(d);
+                }
             }
             checkServerCertificate_GmRequest_(d);
-            iRelease(metaPattern);
         }
     }
     else if (d->state == receivingBody_GmRequestState) {
-        append_Block(&resp->body, data);
+        append_GmBody(&resp->body, data);
         notifyUpdate = iTrue;
     }
     return (notifyUpdate ? 1 : 0) | (notifyDone ? 2 : 0);
@@ -261,11 +380,12 @@ static void readIncoming_GmRequest_(iGmRequest *d, iTlsRequest *req) {
 
 static void applyFilter_GmRequest_(iGmRequest *d) {
     iAssert(d->state == finished_GmRequestState);
-    iBlock *xbody = tryFilter_MimeHooks(mimeHooks_App(), &d->resp->meta, &d->resp->body, &d->url);
+    iBlock *xbody =
+        tryFilter_MimeHooks(mimeHooks_App(), &d->resp->meta, data_GmBody(&d->resp->body), &d->url);
     if (xbody) {
         lock_Mutex(d->mtx);
         clear_String(&d->resp->meta);
-        clear_Block(&d->resp->body);
+        clear_GmBody(&d->resp->body);
         d->state = receivingHeader_GmRequestState;
         processIncomingData_GmRequest_(d, xbody);
         d->state = finished_GmRequestState;
@@ -288,8 +408,11 @@ static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         d->resp->statusCode = tlsFailure_GmStatusCode;
         set_String(&d->resp->meta, errorMessage_TlsRequest(req));
     }
+    endDownload_GmRequest_(d, d->state == finished_GmRequestState);
     checkServerCertificate_GmRequest_(d);
+    join_GmBody(&d->resp->body);
     unlock_Mutex(d->mtx);
+    finished_GmScheduler(scheduler_App(), d);
     /* Check for mimehooks. */
     if (d->isRespFiltered && d->state == finished_GmRequestState) {
         applyFilter_GmRequest_(d);
@@ -441,6 +564,7 @@ static void gopherDisconnected_GmRequest_(iGmRequest *d, iSocket *socket) {
     lock_Mutex(d->mtx);
     if (d->state != failure_GmRequestState) {
         d->state = finished_GmRequestState;
+        join_GmBody(&d->resp->body);
         notify = iTrue;
     }
     unlock_Mutex(d->mtx);
@@ -455,7 +579,7 @@ static void gopherError_GmRequest_(iGmRequest *d, iSocket *socket, int error, co
     d->state = failure_GmRequestState;
     d->resp->statusCode = tlsFailure_GmStatusCode;
     format_String(&d->resp->meta, "%s (errno %d)", msg, error);
-    clear_Block(&d->resp->body);
+    clear_GmBody(&d->resp->body);
     unlock_Mutex(d->mtx);
     iNotifyAudience(d, finished, GmRequestFinished);
 }
@@ -479,20 +603,30 @@ static void beginGopherConnection_GmRequest_(iGmRequest *d, const iString *host,
     }
 }
 
+static void startConnection_GmRequest_(void *context) {
+    /* Called by the scheduler when there is room for a new connection. */
+    iGmRequest *d = context;
+    submit_TlsRequest(d->req);
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
     d->mtx  = new_Mutex();
     d->id   = add_Atomic(&idGen_, 1) + 1;
     d->resp = new_GmResponse();
-    d->isFilterEnabled = iTrue;
-    d->isRespLocked    = iFalse;
-    d->isRespFiltered  = iFalse;
+    d->isFilterEnabled    = iTrue;
+    init_String(&d->downloadPath);
+    d->downloadFile       = NULL;
+    d->isDownloading      = iFalse;
+    d->isRespLocked       = iFalse;
+    d->isRespFiltered     = iFalse;
     set_Atomic(&d->allowUpdate, iTrue);
     init_String(&d->url);
     init_Gopher(&d->gopher);
     d->certs      = certs;
     d->req        = NULL;
+    d->priority   = foreground_GmRequestPriority;
     d->updated    = NULL;
     d->finished   = NULL;
     d->state      = initialized_GmRequestState;
@@ -502,6 +636,8 @@ void deinit_GmRequest(iGmRequest *d) {
     if (d->req) {
         iDisconnectObject(TlsRequest, d->req, readyRead, d);
         iDisconnectObject(TlsRequest, d->req, finished, d);
+        dequeue_GmScheduler(scheduler_App(), d);
+        finished_GmScheduler(scheduler_App(), d);
     }
     lock_Mutex(d->mtx);
     if (!isFinished_GmRequest(d)) {
@@ -517,14 +653,29 @@ void deinit_GmRequest(iGmRequest *d) {
     delete_Audience(d->finished);
     delete_Audience(d->updated);
     delete_GmResponse(d->resp);
+    endDownload_GmRequest_(d, iFalse); /* cancelled */
+    iReleasePtr(&d->downloadFile);
+    deinit_String(&d->downloadPath);
     deinit_String(&d->url);
     delete_Mutex(d->mtx);
 }
 
+void setPriority_GmRequest(iGmRequest *d, enum iGmRequestPriority priority) {
+    d->priority = priority;
+}
+
 void enableFilters_GmRequest(iGmRequest *d, iBool enable) {
     d->isFilterEnabled = enable;
 }
 
+void setDownloadPath_GmRequest(iGmRequest *d, const iString *path) {
+    set_String(&d->downloadPath, path);
+}
+
+void setBodySpillSize_GmRequest(iGmRequest *d, size_t spillSize) {
+    iGuardMutex(d->mtx, setSpillSize_GmBody(&d->resp->body, spillSize));
+}
+
 void setUrl_GmRequest(iGmRequest *d, const iString *url) {
     set_String(&d->url, urlFragmentStripped_String(url));
     /* Encode hostname to Punycode here because we want to submit the Punycode domain name
@@ -585,7 +736,7 @@ void submit_GmRequest(iGmRequest *d) {
         if (src) {
             resp->statusCode = success_GmStatusCode;
             setCStr_String(&resp->meta, "text/gemini; charset=utf-8");
-            set_Block(&resp->body, replaceVariables_(src));
+            set_GmBody(&resp->body, replaceVariables_(src));
             d->state = receivingBody_GmRequestState;
             iNotifyAudience(d, updated, GmRequestUpdated);
         }
@@ -637,13 +788,13 @@ void submit_GmRequest(iGmRequest *d) {
                                     isDirectory_FileInfo(entry) ? iPathSeparator : "");
                 iRelease(entry);
             }
-            set_Block(&resp->body, utf8_String(page));
+            set_GmBody(&resp->body, utf8_String(page));
         }
         else if (open_File(f, readOnly_FileMode)) {
             resp->statusCode = success_GmStatusCode;
             setCStr_String(&resp->meta, mediaType_Path(path));
             /* TODO: Detect text files based on contents? E.g., is the content valid UTF-8. */
-            set_Block(&resp->body, collect_Block(readAll_File(f)));
+            set_GmBody(&resp->body, collect_Block(readAll_File(f)));
             d->state = receivingBody_GmRequestState;
             iNotifyAudience(d, updated, GmRequestUpdated);
         }
@@ -736,7 +887,7 @@ void submit_GmRequest(iGmRequest *d) {
                         }
                         resp->statusCode = success_GmStatusCode;
                         setCStr_String(&resp->meta, "text/gemini; charset=utf-8");
-                        set_Block(&resp->body, utf8_String(page));
+                        set_GmBody(&resp->body, utf8_String(page));
                         delete_String(page);
                     }
                     else {
@@ -744,7 +895,7 @@ void submit_GmRequest(iGmRequest *d) {
                         if (data) {
                             resp->statusCode = success_GmStatusCode;
                             setCStr_String(&resp->meta, mediaType_Path(entryPath));
-                            set_Block(&resp->body, data);
+                            set_GmBody(&resp->body, data);
                         }
                         else {
                             resp->statusCode = failedToOpenFile_GmStatusCode;
@@ -793,7 +944,7 @@ void submit_GmRequest(iGmRequest *d) {
         else {
             set_String(src, collect_String(urlDecode_String(src)));
         }
-        set_Block(&resp->body, &src->chars);
+        set_GmBody(&resp->body, &src->chars);
         d->state = receivingBody_GmRequestState;
         iNotifyAudience(d, updated, GmRequestUpdated);
         d->state = finished_GmRequestState;
@@ -841,11 +992,21 @@ void submit_GmRequest(iGmRequest *d) {
     setHost_TlsRequest(d->req, host, port);
     setContent_TlsRequest(d->req,
                           utf8_String(collectNewFormat_String("%s\r\n", cstr_String(&d->url))));
-    submit_TlsRequest(d->req);
+    enqueue_GmScheduler(scheduler_App(), d, startConnection_GmRequest_, host, d->priority);
 }
 
 void cancel_GmRequest(iGmRequest *d) {
     if (d->req) {
+        if (dequeue_GmScheduler(scheduler_App(), d)) {
+            /* Never connected, so the TlsRequest will not be finishing. */
+            lock_Mutex(d->mtx);
+            d->state            = failure_GmRequestState;
+            d->resp->statusCode = tlsFailure_GmStatusCode;
+            setCStr_String(&d->resp->meta, cstr_Lang("error.cancelled"));
+            unlock_Mutex(d->mtx);
+            iNotifyAudience(d, finished, GmRequestFinished);
+            return;
+        }
         cancel_TlsRequest(d->req);
     }
     cancel_Gopher(&d->gopher);
@@ -893,13 +1054,18 @@ const iString *meta_GmRequest(const iGmRequest *d) {
 }
 
 const iBlock *body_GmRequest(const iGmRequest *d) {
+    iAssert(isFinished_GmRequest(d));
+    return data_GmBody(&d->resp->body);
+}
+
+const iGmBody *chunkedBody_GmRequest(const iGmRequest *d) {
     iAssert(isFinished_GmRequest(d));
     return &d->resp->body;
 }
 
 size_t bodySize_GmRequest(const iGmRequest *d) {
     size_t size;
-    iGuardMutex(d->mtx, size = size_Block(&d->resp->body));
+    iGuardMutex(d->mtx, size = size_GmBody(&d->resp->body));
     return size;
 }
 
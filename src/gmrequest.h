@@ -25,6 +25,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/audience.h>
 #include <the_Foundation/tlsrequest.h>
 
+#include "gmbody.h"
+#include "gmscheduler.h"
 #include "gmutil.h"
 
 iDeclareType(GmCerts)
@@ -42,7 +44,7 @@ enum iGmCertFlag {
 struct Impl_GmResponse {
     enum iGmStatusCode statusCode;
     iString            meta; /* MIME type or other metadata */
-    iBlock             body;
+    iGmBody            body;
     int                certFlags;
     iBlock             certFingerprint;
     iDate              certValidUntil;
@@ -65,7 +67,10 @@ iDeclareNotifyFunc(GmRequest, Finished)
 iDeclareAudienceGetter(GmRequest, updated)
 iDeclareAudienceGetter(GmRequest, finished)
 
+void                setPriority_GmRequest       (iGmRequest *, enum iGmRequestPriority priority); /* before submitting */
 void                enableFilters_GmRequest     (iGmRequest *, iBool enable);
+void                setDownloadPath_GmRequest   (iGmRequest *, const iString *path); /* save non-displayable body here */
+void                setBodySpillSize_GmRequest  (iGmRequest *, size_t spillSize); /* see GmBody */
 void                setUrl_GmRequest            (iGmRequest *, const iString *url);
 void                submit_GmRequest            (iGmRequest *);
 void                cancel_GmRequest            (iGmRequest *);
@@ -77,7 +82,8 @@ uint32_t            id_GmRequest                (const iGmRequest *); /* unique
 iBool               isFinished_GmRequest        (const iGmRequest *);
 enum iGmStatusCode  status_GmRequest            (const iGmRequest *);
 const iString *     meta_GmRequest              (const iGmRequest *);
-const iBlock  *     body_GmRequest              (const iGmRequest *);
+const iBlock  *     body_GmRequest              (const iGmRequest *); /* joins the chunks */
+const iGmBody *     chunkedBody_GmRequest       (const iGmRequest *);
 size_t              bodySize_GmRequest          (const iGmRequest *);
 const iString *     url_GmRequest               (const iGmRequest *);
 
@@ -0,0 +1,232 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include "gmscheduler.h"
+
+#include <the_Foundation/array.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/time.h>
+
+static const size_t maxActive_GmScheduler_           = 16;
+static const size_t maxActiveBackground_GmScheduler_ = 8; /* leave room for the foreground */
+static const size_t maxActivePerHost_GmScheduler_    = 4;
+
+iDeclareType(GmSchedulerEntry)
+
+struct Impl_GmSchedulerEntry {
+    void *                  context;
+    iGmSchedulerStartFunc   start;
+    iString *               host;
+    enum iGmRequestPriority priority;
+    iTime                   queuedAt;
+};
+
+iDeclareType(GmSchedulerStats)
+
+struct Impl_GmSchedulerStats {
+    size_t numStarted;
+    double totalWait; /* seconds */
+    double maxWait;
+};
+
+struct Impl_GmScheduler {
+    iMutex            mtx;
+    iArray            queued; /* GmSchedulerEntry, in submission order */
+    iArray            active;
+    iPtrArray         starting; /* contexts whose start functions are being called */
+    iCondition        started;
+    size_t            maxQueued;
+    iGmSchedulerStats stats[max_GmRequestPriority];
+};
+
+iDefineTypeConstruction(GmScheduler)
+
+void init_GmScheduler(iGmScheduler *d) {
+    init_Mutex(&d->mtx);
+    init_Array(&d->queued, sizeof(iGmSchedulerEntry));
+    init_Array(&d->active, sizeof(iGmSchedulerEntry));
+    init_PtrArray(&d->starting);
+    init_Condition(&d->started);
+    d->maxQueued = 0;
+    iZap(d->stats);
+}
+
+void deinit_GmScheduler(iGmScheduler *d) {
+    iAssert(isEmpty_Array(&d->queued));
+    iForEach(Array, i, &d->active) {
+        delete_String(((iGmSchedulerEntry *) i.value)->host);
+    }
+    deinit_Condition(&d->started);
+    deinit_PtrArray(&d->starting);
+    deinit_Array(&d->active);
+    deinit_Array(&d->queued);
+    deinit_Mutex(&d->mtx);
+}
+
+static size_t numActiveForHost_GmScheduler_(const iGmScheduler *d, const iString *host) {
+    size_t count = 0;
+    iConstForEach(Array, i, &d->active) {
+        const iGmSchedulerEntry *entry = i.value;
+        if (equalCase_String(entry->host, host)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static iBool canStart_GmScheduler_(const iGmScheduler *d, const iGmSchedulerEntry *entry) {
+    if (entry->priority == foreground_GmRequestPriority) {
+        return iTrue; /* never kept waiting */
+    }
+    const size_t maxActive = entry->priority == background_GmRequestPriority
+                                 ? maxActiveBackground_GmScheduler_
+                                 : maxActive_GmScheduler_;
+    return size_Array(&d->active) < maxActive &&
+           numActiveForHost_GmScheduler_(d, entry->host) < maxActivePerHost_GmScheduler_;
+}
+
+static void start_GmScheduler_(iGmScheduler *d, size_t queuedPos, iArray *started) {
+    iGmSchedulerEntry entry = *(const iGmSchedulerEntry *) constAt_Array(&d->queued, queuedPos);
+    remove_Array(&d->queued, queuedPos);
+    iGmSchedulerStats *stats = &d->stats[entry.priority];
+    const double wait = elapsedSeconds_Time(&entry.queuedAt);
+    stats->numStarted++;
+    stats->totalWait += wait;
+    stats->maxWait = iMax(stats->maxWait, wait);
+    pushBack_Array(&d->active, &entry);
+    pushBack_PtrArray(&d->starting, entry.context);
+    pushBack_Array(started, &entry);
+}
+
+static void startQueued_GmScheduler_(iGmScheduler *d, iArray *started) {
+    /* The start functions are called by the caller after unlocking. */
+    for (int prio = 0; prio < max_GmRequestPriority; prio++) {
+        for (size_t pos = 0; pos < size_Array(&d->queued); ) {
+            const iGmSchedulerEntry *entry = constAt_Array(&d->queued, pos);
+            if (entry->priority == (enum iGmRequestPriority) prio && canStart_GmScheduler_(d, entry)) {
+                start_GmScheduler_(d, pos, started);
+            }
+            else {
+                pos++;
+            }
+        }
+    }
+}
+
+static void callStart_GmScheduler_(iGmScheduler *d, iArray *started) {
+    /* Starting a connection may take a while, and it should not happen while other threads
+       are waiting for the scheduler. Until the start function has returned, the context
+       cannot be dequeued (and deleted). */
+    iConstForEach(Array, i, started) {
+        const iGmSchedulerEntry *entry = i.value;
+        entry->start(entry->context);
+    }
+    if (!isEmpty_Array(started)) {
+        lock_Mutex(&d->mtx);
+        iConstForEach(Array, j, started) {
+            removeOne_PtrArray(&d->starting, ((const iGmSchedulerEntry *) j.value)->context);
+        }
+        signalAll_Condition(&d->started);
+        unlock_Mutex(&d->mtx);
+    }
+    deinit_Array(started);
+}
+
+void enqueue_GmScheduler(iGmScheduler *d, void *context, iGmSchedulerStartFunc start,
+                         const iString *host, enum iGmRequestPriority priority) {
+    iGmSchedulerEntry entry = {
+        .context = context, .start = start, .host = copy_String(host), .priority = priority
+    };
+    initCurrent_Time(&entry.queuedAt);
+    iArray started;
+    init_Array(&started, sizeof(iGmSchedulerEntry));
+    lock_Mutex(&d->mtx);
+    pushBack_Array(&d->queued, &entry);
+    d->maxQueued = iMax(d->maxQueued, size_Array(&d->queued));
+    startQueued_GmScheduler_(d, &started);
+    unlock_Mutex(&d->mtx);
+    callStart_GmScheduler_(d, &started);
+}
+
+static size_t find_GmScheduler_(const iArray *entries, const void *context) {
+    for (size_t i = 0; i < size_Array(entries); i++) {
+        if (((const iGmSchedulerEntry *) constAt_Array(entries, i))->context == context) {
+            return i;
+        }
+    }
+    return iInvalidPos;
+}
+
+iBool dequeue_GmScheduler(iGmScheduler *d, void *context) {
+    iBool wasQueued = iFalse;
+    lock_Mutex(&d->mtx);
+    while (indexOf_PtrArray(&d->starting, context) != iInvalidPos) {
+        wait_Condition(&d->started, &d->mtx);
+    }
+    const size_t pos = find_GmScheduler_(&d->queued, context);
+    if (pos != iInvalidPos) {
+        delete_String(((iGmSchedulerEntry *) at_Array(&d->queued, pos))->host);
+        remove_Array(&d->queued, pos);
+        wasQueued = iTrue;
+    }
+    unlock_Mutex(&d->mtx);
+    return wasQueued;
+}
+
+void finished_GmScheduler(iGmScheduler *d, void *context) {
+    iArray started;
+    init_Array(&started, sizeof(iGmSchedulerEntry));
+    lock_Mutex(&d->mtx);
+    const size_t pos = find_GmScheduler_(&d->active, context);
+    if (pos != iInvalidPos) {
+        delete_String(((iGmSchedulerEntry *) at_Array(&d->active, pos))->host);
+        remove_Array(&d->active, pos);
+        startQueued_GmScheduler_(d, &started);
+    }
+    unlock_Mutex(&d->mtx);
+    callStart_GmScheduler_(d, &started);
+}
+
+const iString *debugInfo_GmScheduler(const iGmScheduler *d) {
+    static const char *names[max_GmRequestPriority] = { "Foreground", "Media", "Background" };
+    iGmScheduler *sched = iConstCast(iGmScheduler *, d);
+    iString *msg = collectNew_String();
+    lock_Mutex(&sched->mtx);
+    appendFormat_String(msg, "* Active connections: %zu (limit %zu, %zu per host)\n",
+                        size_Array(&d->active), maxActive_GmScheduler_,
+                        maxActivePerHost_GmScheduler_);
+    appendFormat_String(msg, "* Queue depth: %zu (max %zu)\n", size_Array(&d->queued),
+                        d->maxQueued);
+    for (int i = 0; i < max_GmRequestPriority; i++) {
+        const iGmSchedulerStats *stats = &d->stats[i];
+        if (stats->numStarted) {
+            appendFormat_String(msg, "* %s: %zu started, wait %.0f ms average, %.0f ms max\n",
+                                names[i], stats->numStarted,
+                                1000.0 * stats->totalWait / stats->numStarted,
+                                1000.0 * stats->maxWait);
+        }
+    }
+    unlock_Mutex(&sched->mtx);
+    return msg;
+}
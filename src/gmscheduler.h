@@ -0,0 +1,49 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+#pragma once
+
+#include <the_Foundation/string.h>
+
+/* Decides when network requests get to connect. Foreground requests start immediately, while
+   the others wait in priority order until there is room under the global and per-host
+   connection limits. */
+
+enum iGmRequestPriority {
+    foreground_GmRequestPriority, /* page navigation */
+    media_GmRequestPriority,      /* inline media and downloads */
+    background_GmRequestPriority, /* feeds, remote bookmarks */
+    max_GmRequestPriority
+};
+
+typedef void (*iGmSchedulerStartFunc)(void *context);
+
+iDeclareType(GmScheduler)
+iDeclareTypeConstruction(GmScheduler)
+
+void    enqueue_GmScheduler     (iGmScheduler *, void *context, iGmSchedulerStartFunc start,
+                                 const iString *host, enum iGmRequestPriority priority);
+iBool   dequeue_GmScheduler     (iGmScheduler *, void *context); /* returns True if was waiting */
+void    finished_GmScheduler    (iGmScheduler *, void *context); /* frees the connection slot */
+
+const iString * debugInfo_GmScheduler   (const iGmScheduler *);
@@ -26,6 +26,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/object.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/regexp.h>
+#include <ctype.h>
 
 iRegExp *newGemtextLink_RegExp(void) {
     return new_RegExp("=>\\s*([^\\s]+)(\\s.*)?", 0);
@@ -691,3 +692,24 @@ const iGmError *get_GmError(enum iGmStatusCode code) {
     iAssert(errors_[0].code == unknownStatusCode_GmStatusCode);
     return &errors_[0].err; /* unknown */
 }
+
+uint32_t hash32_Data(uint32_t hash, const void *data, size_t size) {
+    for (const uint8_t *ptr = data, *end = ptr + size; ptr != end; ptr++) {
+        hash = (hash ^ *ptr) * 0x01000193u;
+    }
+    return hash;
+}
+
+uint32_t hash32Case_Data(uint32_t hash, const void *data, size_t size) {
+    for (const uint8_t *ptr = data, *end = ptr + size; ptr != end; ptr++) {
+        hash = (hash ^ (uint8_t) tolower(*ptr)) * 0x01000193u;
+    }
+    return hash;
+}
+
+uint64_t hash64_Data(uint64_t hash, const void *data, size_t size) {
+    for (const uint8_t *ptr = data, *end = ptr + size; ptr != end; ptr++) {
+        hash = (hash ^ *ptr) * 0x100000001b3ull;
+    }
+    return hash;
+}
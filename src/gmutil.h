@@ -131,3 +131,11 @@ const iString * findContainerArchive_Path           (const iString *path);
 
 
 const iString * feedEntryOpenCommand_String (const iString *url, int newTab); /* checks fragment */
+
+/* FNV-1a hashes. To hash more data, pass in the previously returned value. */
+#define initial32_Hash      0x811c9dc5u
+#define initial64_Hash      0xcbf29ce484222325ull
+
+uint32_t        hash32_Data     (uint32_t hash, const void *data, size_t size);
+uint32_t        hash32Case_Data (uint32_t hash, const void *data, size_t size); /* ASCII case-insensitive */
+uint64_t        hash64_Data     (uint64_t hash, const void *data, size_t size);
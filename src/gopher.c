@@ -61,10 +61,10 @@ static iBool isPreformatted_(iRangecc text) {
 
 static void setPre_Gopher_(iGopher *d, iBool pre) {
     if (pre && !d->isPre) {
-        appendCStr_Block(d->output, "```\n");
+        appendCStr_GmBody(d->output, "```\n");
     }
     else if (!pre && d->isPre) {
-        appendCStr_Block(d->output, "```\n");
+        appendCStr_GmBody(d->output, "```\n");
     }
     d->isPre = pre;
 }
@@ -98,8 +98,8 @@ static iBool convertSource_Gopher_(iGopher *d) {
                 case 'i':
                 case '3': {
                     setPre_Gopher_(d, isPreformatted_(text));
-                    appendData_Block(d->output, text.start, size_Range(&text));
-                    appendCStr_Block(d->output, "\n");
+                    appendData_GmBody(d->output, text.start, size_Range(&text));
+                    appendCStr_GmBody(d->output, "\n");
                     break;
                 }
                 case '0':
@@ -121,7 +121,7 @@ static iBool convertSource_Gopher_(iGopher *d) {
                                   cstrCollect_String(
                                       urlEncodeExclude_String(collectNewRange_String(path), "/%")),
                                   cstr_Rangecc(text));
-                    appendData_Block(d->output, constBegin_String(buf), size_String(buf));
+                    appendData_GmBody(d->output, constBegin_String(buf), size_String(buf));
                     iEndCollect();
                     break;
                 }
@@ -134,7 +134,7 @@ static iBool convertSource_Gopher_(iGopher *d) {
                                       cstr_Rangecc((iRangecc){ path.start + 4, path.end }),
                                       cstr_Rangecc(text));
                     }
-                    appendData_Block(d->output, constBegin_String(buf), size_String(buf));
+                    appendData_GmBody(d->output, constBegin_String(buf), size_String(buf));
                     iEndCollect();
                     break;
                 }
@@ -256,7 +256,7 @@ iBool processResponse_Gopher(iGopher *d, const iBlock *data) {
         }
     }
     else {
-        append_Block(d->output, data);
+        append_GmBody(d->output, data);
         changed = iTrue;
     }
     return changed;
@@ -22,6 +22,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #pragma once
 
+#include "gmbody.h"
 #include "gmutil.h"
 
 #include <the_Foundation/regexp.h>
@@ -36,7 +37,7 @@ struct Impl_Gopher {
     iBool    isPre;
     iBool    needQueryArgs;
     iString *meta;
-    iBlock * output;
+    iGmBody *output;
 };
 
 iDeclareTypeConstruction(Gopher)
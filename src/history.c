@@ -23,6 +23,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "history.h"
 #include "ui/root.h"
 #include "app.h"
+#include "defs.h"
+#include "gmcache.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/mutex.h>
@@ -31,16 +33,26 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <math.h>
 
 static const size_t maxStack_History_ = 50; /* back/forward navigable items */
+static const size_t minDeflateSize_History_ = 1024; /* smaller bodies are not compressed */
+
+enum iRecentUrlCacheMode {
+    none_RecentUrlCacheMode   = 0,
+    inline_RecentUrlCacheMode = 1, /* response serialized with the history */
+    disk_RecentUrlCacheMode   = 2, /* response is in the disk cache; loaded when needed */
+};
 
 void init_RecentUrl(iRecentUrl *d) {
     init_String(&d->url);
     d->normScrollY = 0;
     d->cachedResponse = NULL;
+    d->deflatedBody = NULL;
+    d->inflatedSize = 0;
 }
 
 void deinit_RecentUrl(iRecentUrl *d) {
     deinit_String(&d->url);
     delete_GmResponse(d->cachedResponse);
+    delete_Block(d->deflatedBody);
 }
 
 iDefineTypeConstruction(RecentUrl)
@@ -50,9 +62,84 @@ iRecentUrl *copy_RecentUrl(const iRecentUrl *d) {
     set_String(&copy->url, &d->url);
     copy->normScrollY = d->normScrollY;
     copy->cachedResponse = d->cachedResponse ? copy_GmResponse(d->cachedResponse) : NULL;
+    copy->deflatedBody = d->deflatedBody ? copy_Block(d->deflatedBody) : NULL;
+    copy->inflatedSize = d->inflatedSize;
     return copy;
 }
 
+static void clearCachedResponse_RecentUrl_(iRecentUrl *d) {
+    delete_GmResponse(d->cachedResponse);
+    d->cachedResponse = NULL;
+    delete_Block(d->deflatedBody);
+    d->deflatedBody = NULL;
+    d->inflatedSize = 0;
+}
+
+static size_t cachedSize_RecentUrl_(const iRecentUrl *d) {
+    /* Memory actually used by the cached body. */
+    if (d->deflatedBody) {
+        return size_Block(d->deflatedBody);
+    }
+    return d->cachedResponse ? size_GmBody(&d->cachedResponse->body) : 0;
+}
+
+static size_t rawSize_RecentUrl_(const iRecentUrl *d) {
+    if (d->deflatedBody) {
+        return d->inflatedSize;
+    }
+    return d->cachedResponse ? size_GmBody(&d->cachedResponse->body) : 0;
+}
+
+static void deflate_RecentUrl_(iRecentUrl *d) {
+#if defined (iHaveZlib)
+    if (!d->cachedResponse || d->deflatedBody ||
+        size_GmBody(&d->cachedResponse->body) < minDeflateSize_History_ ||
+        isSpilled_GmBody(&d->cachedResponse->body)) {
+        return;
+    }
+    iBlock *deflated = compress_Block(data_GmBody(&d->cachedResponse->body));
+    if (size_Block(deflated) < size_GmBody(&d->cachedResponse->body)) {
+        d->deflatedBody = deflated;
+        d->inflatedSize = size_GmBody(&d->cachedResponse->body);
+        clear_GmBody(&d->cachedResponse->body);
+    }
+    else {
+        delete_Block(deflated);
+    }
+#else
+    iUnused(d);
+#endif
+}
+
+static void inflate_RecentUrl_(iRecentUrl *d) {
+#if defined (iHaveZlib)
+    if (d->deflatedBody) {
+        iBlock *data = decompress_Block(d->deflatedBody);
+        set_GmBody(&d->cachedResponse->body, data);
+        delete_Block(data);
+        delete_Block(d->deflatedBody);
+        d->deflatedBody = NULL;
+        d->inflatedSize = 0;
+    }
+#else
+    iUnused(d);
+#endif
+}
+
+static iGmResponse *inflatedResponse_RecentUrl_(const iRecentUrl *d) {
+    /* Returns a new uncompressed copy of the cached response. */
+    iRecentUrl temp;
+    init_RecentUrl(&temp);
+    temp.cachedResponse = copy_GmResponse(d->cachedResponse);
+    temp.deflatedBody   = d->deflatedBody ? copy_Block(d->deflatedBody) : NULL;
+    temp.inflatedSize   = d->inflatedSize;
+    inflate_RecentUrl_(&temp);
+    iGmResponse *resp = temp.cachedResponse;
+    temp.cachedResponse = NULL;
+    deinit_RecentUrl(&temp);
+    return resp;
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_History {
@@ -92,19 +179,22 @@ iString *debugInfo_History(const iHistory *d) {
     iString *str = new_String();
     format_String(str,
                   "```\n"
-                  "Idx |    Size | SP%% | URL\n"
-                  "----+---------+-----+-----\n");
+                  "Idx |     Size | SP%% | URL\n"
+                  "----+----------+-----+-----\n");
     size_t totalSize = 0;
+    size_t totalRawSize = 0;
     iConstForEach(Array, i, &d->recent) {
         const iRecentUrl *item = i.value;
         appendFormat_String(
             str, " %2zu | ", size_Array(&d->recent) - index_ArrayConstIterator(&i) - 1);
         if (item->cachedResponse) {
-            appendFormat_String(str, "%7zu", size_Block(&item->cachedResponse->body));
-            totalSize += size_Block(&item->cachedResponse->body);
+            appendFormat_String(str, "%7zu%s", cachedSize_RecentUrl_(item),
+                                item->deflatedBody ? "z" : " ");
+            totalSize    += cachedSize_RecentUrl_(item);
+            totalRawSize += rawSize_RecentUrl_(item);
         }
         else {
-            appendFormat_String(str, "     --");
+            appendFormat_String(str, "     -- ");
         }
         appendFormat_String(str,
                             " | %3d | %s\n",
@@ -113,13 +203,35 @@ iString *debugInfo_History(const iHistory *d) {
     }
     appendFormat_String(str, "\n```\n");
     appendFormat_String(str,
-                        "Total cached data: %.3f MB\n"
+                        "Total cached data: %.3f MB (%.3f MB uncompressed; z: compressed)\n"
                         "Navigation position: %zu\n\n",
                         totalSize / 1.0e6f,
+                        totalRawSize / 1.0e6f,
                         d->recentPos);
     return str;
 }
 
+void storeCache_History(const iHistory *d) {
+    /* Keeping the bodies out of the state file lets it load quickly. This is done for all
+       histories before any of them are serialized, because storing may evict entries that
+       were stored earlier. */
+    lock_Mutex(d->mtx);
+    iConstForEach(Array, i, &d->recent) {
+        const iRecentUrl *item = i.value;
+        if (item->cachedResponse &&
+            !contains_GmCache(cache_App(),
+                              &item->url,
+                              rawSize_RecentUrl_(item),
+                              &item->cachedResponse->when)) {
+            /* Only inflated if not stored already. */
+            iGmResponse *resp = inflatedResponse_RecentUrl_(item);
+            store_GmCache(cache_App(), &item->url, resp);
+            delete_GmResponse(resp);
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
+
 void serialize_History(const iHistory *d, iStream *outs) {
     lock_Mutex(d->mtx);
     writeU16_Stream(outs, d->recentPos);
@@ -129,11 +241,21 @@ void serialize_History(const iHistory *d, iStream *outs) {
         serialize_String(&item->url, outs);
         write32_Stream(outs, item->normScrollY * 1.0e6f);
         if (item->cachedResponse) {
-            write8_Stream(outs, 1);
-            serialize_GmResponse(item->cachedResponse, outs);
+            if (contains_GmCache(cache_App(),
+                                 &item->url,
+                                 rawSize_RecentUrl_(item),
+                                 &item->cachedResponse->when)) {
+                write8_Stream(outs, disk_RecentUrlCacheMode);
+            }
+            else {
+                iGmResponse *resp = inflatedResponse_RecentUrl_(item);
+                write8_Stream(outs, inline_RecentUrlCacheMode);
+                serialize_GmResponse(resp, outs);
+                delete_GmResponse(resp);
+            }
         }
         else {
-            write8_Stream(outs, 0);
+            write8_Stream(outs, none_RecentUrlCacheMode);
         }
     }
     unlock_Mutex(d->mtx);
@@ -149,7 +271,7 @@ void deserialize_History(iHistory *d, iStream *ins) {
         init_RecentUrl(&item);
         deserialize_String(&item.url, ins);
         item.normScrollY = (float) read32_Stream(ins) / 1.0e6f;
-        if (read8_Stream(ins)) {
+        if (read8_Stream(ins) == inline_RecentUrlCacheMode) {
             item.cachedResponse = new_GmResponse();
             deserialize_GmResponse(item.cachedResponse, ins);
         }
@@ -193,10 +315,24 @@ const iString *url_History(const iHistory *d, size_t pos) {
     return collectNew_String();
 }
 
+static void updateDeflated_History_(iHistory *d) {
+    /* Only the current page is kept uncompressed. */
+    const iRecentUrl *current = mostRecentUrl_History(d);
+    iForEach(Array, i, &d->recent) {
+        if (i.value == current) {
+            inflate_RecentUrl_(i.value);
+        }
+        else {
+            deflate_RecentUrl_(i.value);
+        }
+    }
+}
+
 iRecentUrl *findUrl_History(iHistory *d, const iString *url) {
     lock_Mutex(d->mtx);
     iReverseForEach(Array, i, &d->recent) {
         if (cmpStringCase_String(url, &((iRecentUrl *) i.value)->url) == 0) {
+            inflate_RecentUrl_(i.value); /* about to be shown */
             unlock_Mutex(d->mtx);
             return i.value;
         }
@@ -238,6 +374,7 @@ void add_History(iHistory *d, const iString *url ){
             remove_Array(&d->recent, 0);
         }
     }
+    updateDeflated_History_(d);
     unlock_Mutex(d->mtx);
 }
 
@@ -245,6 +382,7 @@ iBool goBack_History(iHistory *d) {
     lock_Mutex(d->mtx);
     if (!isEmpty_Array(&d->recent) && d->recentPos < size_Array(&d->recent) - 1) {
         d->recentPos++;
+        updateDeflated_History_(d);
         postCommandf_Root(get_Root(),
                           "open history:1 scroll:%f url:%s",
                           mostRecentUrl_History(d)->normScrollY,
@@ -260,6 +398,7 @@ iBool goForward_History(iHistory *d) {
     lock_Mutex(d->mtx);
     if (d->recentPos > 0) {
         d->recentPos--;
+        updateDeflated_History_(d);
         postCommandf_Root(get_Root(),
                           "open history:1 scroll:%f url:%s",
                           mostRecentUrl_History(d)->normScrollY,
@@ -293,8 +432,7 @@ void setCachedResponse_History(iHistory *d, const iGmResponse *response) {
     lock_Mutex(d->mtx);
     iRecentUrl *item = mostRecentUrl_History(d);
     if (item) {
-        delete_GmResponse(item->cachedResponse);
-        item->cachedResponse = NULL;
+        clearCachedResponse_RecentUrl_(item);
         if (category_GmStatusCode(response->statusCode) == categorySuccess_GmStatusCode) {
             item->cachedResponse = copy_GmResponse(response);
         }
@@ -306,10 +444,7 @@ size_t cacheSize_History(const iHistory *d) {
     size_t cached = 0;
     lock_Mutex(d->mtx);
     iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            cached += size_Block(&url->cachedResponse->body);
-        }
+        cached += cachedSize_RecentUrl_(i.value);
     }
     unlock_Mutex(d->mtx);
     return cached;
@@ -318,42 +453,88 @@ size_t cacheSize_History(const iHistory *d) {
 void clearCache_History(iHistory *d) {
     lock_Mutex(d->mtx);
     iForEach(Array, i, &d->recent) {
-        iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            delete_GmResponse(url->cachedResponse);
-            url->cachedResponse = NULL;
-        }
+        clearCachedResponse_RecentUrl_(i.value);
     }
     unlock_Mutex(d->mtx);
 }
 
-size_t pruneLeastImportant_History(iHistory *d) {
-    size_t delta  = 0;
-    size_t chosen = iInvalidPos;
-    double score  = 0.0f;
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(CachedItem)
+
+struct Impl_CachedItem {
+    iHistory *history;
+    size_t    index; /* in `recent` */
+    size_t    size;
+    double    score; /* higher is less useful */
+};
+
+static void siftDown_CachedItem_(iCachedItem *heap, size_t count, size_t pos) {
+    for (;;) {
+        size_t largest = pos;
+        const size_t left = 2 * pos + 1, right = left + 1;
+        if (left < count && heap[left].score > heap[largest].score) {
+            largest = left;
+        }
+        if (right < count && heap[right].score > heap[largest].score) {
+            largest = right;
+        }
+        if (largest == pos) {
+            break;
+        }
+        iSwap(iCachedItem, heap[pos], heap[largest]);
+        pos = largest;
+    }
+}
+
+size_t trimCaches_History(const iPtrArray *histories, size_t maxSize) {
+    /* All cached responses of all histories compete for the same budget. The scores depend on
+       the current time, so the heap is built for each trim; evicting is then O(log n) per
+       response, and the least useful ones go first regardless of which tab they are in. */
+    iArray items;
+    init_Array(&items, sizeof(iCachedItem));
+    size_t totalSize = 0;
     iTime now;
     initCurrent_Time(&now);
-    lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            const double urlScore =
-                size_Block(&url->cachedResponse->body) *
-                pow(secondsSince_Time(&now, &url->cachedResponse->when) / 60.0, 1.25);
-            if (urlScore > score) {
-                chosen = index_ArrayConstIterator(&i);
-                score  = urlScore;
+    iConstForEach(PtrArray, h, histories) {
+        iHistory *hist = (iHistory *) h.ptr;
+        lock_Mutex(hist->mtx);
+        iConstForEach(Array, i, &hist->recent) {
+            const iRecentUrl *url = i.value;
+            if (url->cachedResponse) {
+                const iCachedItem item = {
+                    .history = hist,
+                    .index   = index_ArrayConstIterator(&i),
+                    .size    = cachedSize_RecentUrl_(url),
+                    .score   = cachedSize_RecentUrl_(url) *
+                             pow(secondsSince_Time(&now, &url->cachedResponse->when) / 60.0, 1.25),
+                };
+                pushBack_Array(&items, &item);
+                totalSize += item.size;
             }
         }
+        unlock_Mutex(hist->mtx);
     }
-    if (chosen != iInvalidPos) {
-        iRecentUrl *url = at_Array(&d->recent, chosen);
-        delta = size_Block(&url->cachedResponse->body);
-        delete_GmResponse(url->cachedResponse);
-        url->cachedResponse = NULL;
+    size_t freed = 0;
+    if (totalSize > maxSize) {
+        iCachedItem *heap = data_Array(&items);
+        size_t       num  = size_Array(&items);
+        for (size_t pos = num / 2; pos-- > 0; ) {
+            siftDown_CachedItem_(heap, num, pos);
+        }
+        while (totalSize > maxSize && num > 0) {
+            const iCachedItem top = heap[0];
+            heap[0] = heap[--num];
+            siftDown_CachedItem_(heap, num, 0);
+            lock_Mutex(top.history->mtx);
+            clearCachedResponse_RecentUrl_(at_Array(&top.history->recent, top.index));
+            unlock_Mutex(top.history->mtx);
+            totalSize -= top.size;
+            freed     += top.size;
+        }
     }
-    unlock_Mutex(d->mtx);
-    return delta;
+    deinit_Array(&items);
+    return freed;
 }
 
 const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern) {
@@ -363,20 +544,26 @@ const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pat
     init_StringSet(&inserted);
     iReverseConstForEach(Array, i, &d->recent) {
         const iRecentUrl *url = i.value;
-        const iGmResponse *resp = url->cachedResponse;
-        if (resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode) {
-            if (indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) == iInvalidPos) {
+        if (url->cachedResponse &&
+            category_GmStatusCode(url->cachedResponse->statusCode) == categorySuccess_GmStatusCode) {
+            if (indexOfCStrSc_String(&url->cachedResponse->meta, "text/", &iCaseInsensitive) ==
+                iInvalidPos) {
                 continue;
             }
+            iGmResponse *inflated = url->deflatedBody ? inflatedResponse_RecentUrl_(url) : NULL;
+            const iGmResponse *resp = inflated ? inflated : url->cachedResponse;
+            iBlock data;
+            init_Block(&data, 0);
+            getData_GmBody(&resp->body, &data);
             iRegExpMatch m;
             init_RegExpMatch(&m);
-            if (matchRange_RegExp(pattern, range_Block(&resp->body), &m)) {
+            if (matchRange_RegExp(pattern, range_Block(&data), &m)) {
                 iString entry;
                 init_String(&entry);
                 iRangei cap = m.range;
                 const int prefix = iMin(10, cap.start);
                 cap.start   = cap.start - prefix;
-                cap.end     = iMin(cap.end + 30, (int) size_Block(&resp->body));
+                cap.end     = iMin(cap.end + 30, (int) size_GmBody(&resp->body));
                 const size_t maxLen = 60;
                 if (size_Range(&cap) > maxLen) {
                     cap.end = cap.start + maxLen;
@@ -400,6 +587,8 @@ const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pat
                 }
                 deinit_String(&entry);
             }
+            deinit_Block(&data);
+            delete_GmResponse(inflated);
         }
     }
     deinit_StringSet(&inserted);
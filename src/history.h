@@ -37,6 +37,8 @@ struct Impl_RecentUrl {
     iString      url;
     float        normScrollY;    /* normalized to document height */
     iGmResponse *cachedResponse; /* kept in memory for quicker back navigation */
+    iBlock *     deflatedBody;   /* if set, cachedResponse's body is only kept compressed */
+    size_t       inflatedSize;
 };
 
 /*----------------------------------------------------------------------------------------------*/
@@ -57,7 +59,8 @@ iRecentUrl *recentUrl_History           (iHistory *, size_t pos);
 iRecentUrl *mostRecentUrl_History       (iHistory *);
 iRecentUrl *findUrl_History             (iHistory *, const iString *url);
 void        clearCache_History          (iHistory *);
-size_t      pruneLeastImportant_History (iHistory *);
+void        storeCache_History          (const iHistory *); /* into the disk cache */
+size_t      trimCaches_History          (const iPtrArray *histories, size_t maxSize); /* returns bytes freed */
 
 iBool       atLatest_History            (const iHistory *);
 iBool       atOldest_History            (const iHistory *);
@@ -21,6 +21,7 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "media.h"
+#include "gmbody.h"
 #include "gmdocument.h"
 #include "gmrequest.h"
 #include "ui/window.h"
@@ -38,10 +39,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 iDeclareType(GmMediaProps)
 
 struct Impl_GmMediaProps {
-    iGmLinkId linkId;
-    iString   mime;
-    iString   url;
-    iBool     isPermanent;
+    iGmLinkId     linkId;
+    iString       mime;
+    iString       url;
+    iBool         isPermanent;
+    iGmBodyReader reader; /* how much of the source data has been seen */
 };
 
 static void init_GmMediaProps_(iGmMediaProps *d) {
@@ -49,13 +51,22 @@ static void init_GmMediaProps_(iGmMediaProps *d) {
     init_String(&d->mime);
     init_String(&d->url);
     d->isPermanent = iFalse;
+    init_GmBodyReader(&d->reader);
 }
 
 static void deinit_GmMediaProps_(iGmMediaProps *d) {
+    deinit_GmBodyReader(&d->reader);
     deinit_String(&d->url);
     deinit_String(&d->mime);
 }
 
+static void appendNewData_GmMediaProps_(iGmMediaProps *d, const iGmBody *body, iBlock *data) {
+    iRangecc piece;
+    while (readNext_GmBodyReader(&d->reader, body, &piece)) {
+        appendData_Block(data, piece.start, size_Range(&piece));
+    }
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(GmImage)
@@ -68,9 +79,9 @@ struct Impl_GmImage {
     SDL_Texture * texture;
 };
 
-void init_GmImage(iGmImage *d, const iBlock *data) {
+void init_GmImage(iGmImage *d) {
     init_GmMediaProps_(&d->props);
-    initCopy_Block(&d->partialData, data);
+    init_Block(&d->partialData, 0);
     d->size     = zero_I2();
     d->numBytes = 0;
     d->texture  = NULL;
@@ -133,7 +144,7 @@ void makeTexture_GmImage(iGmImage *d) {
     clear_Block(data);
 }
 
-iDefineTypeConstructionArgs(GmImage, (const iBlock *data), data)
+iDefineTypeConstruction(GmImage)
 
 /*----------------------------------------------------------------------------------------------*/
 
@@ -169,6 +180,7 @@ struct Impl_GmDownload {
     float         currentRate;
     iString *     path;
     iFile *       file;
+    iBool         isFinished;
 };
 
 static iBool openFile_GmDownload_(iGmDownload *d) {
@@ -183,6 +195,7 @@ static iBool openFile_GmDownload_(iGmDownload *d) {
 
 static void closeFile_GmDownload_(iGmDownload *d) {
     d->currentRate = (float) (d->numBytes / elapsedSeconds_Time(&d->startTime));
+    d->isFinished  = iTrue;
     iReleasePtr(&d->file);
 }
 
@@ -195,6 +208,7 @@ void init_GmDownload(iGmDownload *d) {
     d->currentRate   = 0.0f;
     d->path          = NULL;
     d->file          = NULL;
+    d->isFinished    = iFalse;
 }
 
 void deinit_GmDownload(iGmDownload *d) {
@@ -203,14 +217,9 @@ void deinit_GmDownload(iGmDownload *d) {
     delete_String(d->path);
 }
 
-static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
+static void addBytes_GmDownload_(iGmDownload *d, size_t newBytes) {
     const static unsigned rateInterval_ = 1000;
-    iAssert(d->file);
-    writeData_File(d->file,
-                   constBegin_Block(data) + d->numBytes,
-                   size_Block(data) - d->numBytes);
-    const size_t newBytes = size_Block(data) - d->numBytes;
-    d->numBytes = size_Block(data);
+    d->numBytes += newBytes;
     d->rateNumBytes += newBytes;
     const uint32_t now = SDL_GetTicks();
     if (now - d->rateStartTime > rateInterval_) {
@@ -221,6 +230,18 @@ static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
     }
 }
 
+static void writeToFile_GmDownload_(iGmDownload *d, const iGmBody *body) {
+    iAssert(d->file);
+    /* The new data is written straight from the body's chunks. */
+    size_t   newBytes = 0;
+    iRangecc piece;
+    while (readNext_GmBodyReader(&d->props.reader, body, &piece)) {
+        writeData_File(d->file, piece.start, size_Range(&piece));
+        newBytes += size_Range(&piece);
+    }
+    addBytes_GmDownload_(d, newBytes);
+}
+
 iDefineTypeConstruction(GmDownload)
 
 /*----------------------------------------------------------------------------------------------*/
@@ -280,11 +301,11 @@ iBool setDownloadUrl_Media(iMedia *d, iGmLinkId linkId, const iString *url) {
     return isNew;
 }
 
-iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlock *data,
+iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iGmBody *body,
                     int flags) {
     const iBool isPartial  = (flags & partialData_MediaFlag) != 0;
     const iBool allowHide  = (flags & allowHide_MediaFlag) != 0;
-    const iBool isDeleting = (!mime || !data);
+    const iBool isDeleting = (!mime || !body);
     iMediaId    existing   = findLinkImage_Media(d, linkId);
     iBool       isNew      = iFalse;
     if (existing) {
@@ -296,9 +317,11 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
         else {
             img = at_PtrArray(&d->images, existing - 1);
             iAssert(equal_String(&img->props.mime, mime)); /* MIME cannot change */
-            set_Block(&img->partialData, data);
-            if (!isPartial) {
-                makeTexture_GmImage(img);
+            if (!img->texture) {
+                appendNewData_GmMediaProps_(&img->props, body, &img->partialData);
+                if (!isPartial) {
+                    makeTexture_GmImage(img);
+                }
             }
         }
     }
@@ -311,7 +334,10 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
         else {
             audio = at_PtrArray(&d->audio, existing - 1);
             iAssert(equal_String(&audio->props.mime, mime)); /* MIME cannot change */
-            updateSourceData_Player(audio->player, mime, data, append_PlayerUpdate);
+            iBlock *newData = new_Block(0);
+            appendNewData_GmMediaProps_(&audio->props, body, newData);
+            updateSourceData_Player(audio->player, mime, newData, append_PlayerUpdate);
+            delete_Block(newData);
             if (!isPartial) {
                 updateSourceData_Player(audio->player, NULL, NULL, complete_PlayerUpdate);
             }
@@ -329,13 +355,26 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
         }
         else {
             dl = at_PtrArray(&d->downloads, existing - 1);
+            if (dl->isFinished) {
+                return iFalse; /* already saved */
+            }
             if (isEmpty_String(&dl->props.mime)) {
                 set_String(&dl->props.mime, mime);
             }
-            if (!dl->file) {
-                openFile_GmDownload_(dl);
+            const iFile *sink = sink_GmBody(body);
+            if (sink) {
+                /* The request itself is writing the data to the file. */
+                if (!dl->path) {
+                    dl->path = copy_String(path_File(sink));
+                }
+                addBytes_GmDownload_(dl, size_GmBody(body) - dl->numBytes);
+            }
+            else {
+                if (!dl->file) {
+                    openFile_GmDownload_(dl);
+                }
+                writeToFile_GmDownload_(dl, body);
             }
-            writeToFile_GmDownload_(dl, data);
             if (!isPartial) {
                 closeFile_GmDownload_(dl);
             }
@@ -344,10 +383,11 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
     else if (!isDeleting) {
         if (startsWith_String(mime, "image/")) {
             /* Copy the image to a texture. */
-            iGmImage *img = new_GmImage(data);
+            iGmImage *img = new_GmImage();
             img->props.linkId = linkId; /* TODO: use a hash? */
             img->props.isPermanent = !allowHide;
             set_String(&img->props.mime, mime);
+            appendNewData_GmMediaProps_(&img->props, body, &img->partialData);
             pushBack_PtrArray(&d->images, img);
             if (!isPartial) {
                 makeTexture_GmImage(img);
@@ -359,7 +399,10 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
             audio->props.linkId = linkId; /* TODO: use a hash? */
             audio->props.isPermanent = !allowHide;
             set_String(&audio->props.mime, mime);
+            iBlock *data = new_Block(0);
+            appendNewData_GmMediaProps_(&audio->props, body, data);
             updateSourceData_Player(audio->player, mime, data, replace_PlayerUpdate);
+            delete_Block(data);
             if (!isPartial) {
                 updateSourceData_Player(audio->player, NULL, NULL, complete_PlayerUpdate);
             }
@@ -487,12 +530,14 @@ void downloadStats_Media(const iMedia *d, iMediaId downloadId, const iString **p
             *path_out = dl->path;
         }
         *bytesPerSecond_out = dl->currentRate;
-        *isFinished_out = (dl->path && !dl->file);
+        *isFinished_out = dl->isFinished;
     }
 }
 
 /*----------------------------------------------------------------------------------------------*/
 
+static const size_t downloadSpillSize_MediaRequest_ = 4 * 1024 * 1024; /* bytes */
+
 static void updated_MediaRequest_(iAnyObject *obj) {
     iMediaRequest *d = obj;
     postCommandf_App("media.updated link:%u request:%p", d->linkId, d);
@@ -504,12 +549,21 @@ static void finished_MediaRequest_(iAnyObject *obj) {
 }
 
 void init_MediaRequest(iMediaRequest *d, iDocumentWidget *doc, unsigned int linkId,
-                       const iString *url, iBool enableFilters) {
+                       const iString *url, iBool enableFilters, iBool isDownload) {
     d->doc    = doc;
     d->linkId = linkId;
     d->req    = new_GmRequest(certs_App());
     setUrl_GmRequest(d->req, url);
+    setPriority_GmRequest(d->req, media_GmRequestPriority);
     enableFilters_GmRequest(d->req, enableFilters);
+    if (isDownload) {
+        /* Downloads are written to a file as they arrive, so the body doesn't need to be
+           kept in memory. Non-displayable content is written by the request directly. The
+           path is chosen here because the MIME type only affects the names of displayable
+           content. */
+        setDownloadPath_GmRequest(d->req, downloadPathForUrl_App(url, collectNew_String()));
+        setBodySpillSize_GmRequest(d->req, downloadSpillSize_MediaRequest_);
+    }
     iConnect(GmRequest, d->req, updated, d, updated_MediaRequest_);
     iConnect(GmRequest, d->req, finished, d, finished_MediaRequest_);
     submit_GmRequest(d->req);
@@ -523,6 +577,6 @@ void deinit_MediaRequest(iMediaRequest *d) {
 
 iDefineObjectConstructionArgs(MediaRequest,
                               (iDocumentWidget *doc, unsigned int linkId, const iString *url,
-                               iBool enableFilters),
-                              doc, linkId, url, enableFilters)
+                               iBool enableFilters, iBool isDownload),
+                              doc, linkId, url, enableFilters, isDownload)
 iDefineClass(MediaRequest)
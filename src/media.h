@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 typedef uint16_t iMediaId;
 
+iDeclareType(GmBody)
 iDeclareType(Player)
 iDeclareType(GmMediaInfo)
 
@@ -48,7 +49,7 @@ enum iMediaFlags {
 
 void    clear_Media             (iMedia *);
 iBool   setDownloadUrl_Media    (iMedia *, uint16_t linkId, const iString *url);
-iBool   setData_Media           (iMedia *, uint16_t linkId, const iString *mime, const iBlock *data, int flags);
+iBool   setData_Media           (iMedia *, uint16_t linkId, const iString *mime, const iGmBody *body, int flags);
 
 iMediaId        findLinkImage_Media (const iMedia *, uint16_t linkId);
 iBool           imageInfo_Media     (const iMedia *, iMediaId imageId, iGmMediaInfo *info_out);
@@ -80,4 +81,4 @@ struct Impl_MediaRequest {
 };
 
 iDeclareObjectConstructionArgs(MediaRequest, iDocumentWidget *doc, unsigned int linkId,
-                               const iString *url, iBool enableFilters)
+                               const iString *url, iBool enableFilters, iBool isDownload)
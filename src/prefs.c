@@ -44,6 +44,10 @@ void init_Prefs(iPrefs *d) {
     d->loadImageInsteadOfScrolling = iFalse;
     d->collapsePreOnLoad = iFalse;
     d->openArchiveIndexPages = iTrue;
+    d->hibernateAfter    = 30;
+    d->prefetchLinks     = iFalse;
+    d->maxFeedRequests   = 8;
+    d->maxFeedRequestsPerHost = 2;
     d->decodeUserVisibleURLs = iTrue;
     d->maxCacheSize      = 10;
     d->font              = nunito_TextFont;
@@ -61,6 +61,10 @@ struct Impl_Prefs {
     iBool            collapsePreOnLoad;
     iString          searchUrl;
     iBool            openArchiveIndexPages;
+    int              hibernateAfter; /* minutes; zero to keep hidden tabs loaded */
+    iBool            prefetchLinks; /* fetch same-host links while hovering over them */
+    int              maxFeedRequests; /* concurrent requests when refreshing feeds */
+    int              maxFeedRequestsPerHost;
     /* Network */
     iString          caFile;
     iString          caPath;
@@ -31,8 +31,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "command.h"
 #include "defs.h"
 #include "gempub.h"
+#include "gmcache.h"
 #include "gmcerts.h"
 #include "gmdocument.h"
+#include "gmprefetch.h"
 #include "gmrequest.h"
 #include "gmutil.h"
 #include "history.h"
@@ -65,6 +67,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/ptrset.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/stringarray.h>
+#include <the_Foundation/thread.h>
 #include <SDL_clipboard.h>
 #include <SDL_timer.h>
 #include <SDL_render.h>
@@ -201,6 +204,7 @@ static void prerender_DocumentWidget_           (iAny *);
 static void scrollBegan_DocumentWidget_         (iAnyObject *, int, uint32_t);
 
 static const int smoothDuration_DocumentWidget_  = 600; /* milliseconds */
+static const size_t backgroundLayoutMinSize_DocumentWidget_ = 256 * 1024; /* bytes */
 
 enum iRequestState {
     blank_RequestState,
@@ -223,6 +227,8 @@ enum iDocumentWidgetFlag {
     movingSelectMarkEnd_DocumentWidgetFlag   = iBit(11),
     otherRootByDefault_DocumentWidgetFlag    = iBit(12), /* links open to other root by default */
     urlChanged_DocumentWidgetFlag            = iBit(13),
+    pendingLayout_DocumentWidgetFlag         = iBit(14), /* more content to lay out in background */
+    deferredRestore_DocumentWidgetFlag       = iBit(15), /* restored tab not loaded until shown */
 };
 
 enum iDocumentLinkOrdinalMode {
@@ -243,6 +249,7 @@ struct Impl_DocumentWidget {
     const iGmRun * grabbedPlayer; /* currently adjusting volume in a player */
     float          grabbedStartVolume;
     int            mediaTimer;
+    int            prefetchTimer; /* hover intent */
     const iGmRun * hoverPre;    /* for clicking */
     const iGmRun * hoverAltPre; /* for drawing alt text */
     const iGmRun * hoverLink;
@@ -267,6 +274,8 @@ struct Impl_DocumentWidget {
     /* Document: */
     iPersistentDocumentState mod;
     iString *      titleUser;
+    iString *      restoredTitle; /* shown until a deferred tab is loaded */
+    iTime          hiddenSince;   /* zero while shown */
     enum iGmStatusCode sourceStatus;
     iString        sourceHeader;
     iString        sourceMime;
@@ -279,6 +288,12 @@ struct Impl_DocumentWidget {
     int            pageMargin;
     float          initNormScrollY;
     iSmoothScroll  scrollY;
+    iThread *      layoutWorker; /* lays out `layoutDoc` in the background */
+    iGmDocument *  layoutDoc;
+    iString        layoutSource;
+    iString        pendingLayoutSource;
+    int            layoutWidth;
+    uint32_t       layoutReqId; /* zero if the background layout should be discarded */
     iAnim          sideOpacity;
     iAnim          altTextOpacity;
     iGmRunRange    visibleRuns;
@@ -325,6 +340,7 @@ void init_DocumentWidget(iDocumentWidget *d) {
     d->certSubject      = new_String();
     d->state            = blank_RequestState;
     d->titleUser        = new_String();
+    d->restoredTitle    = new_String();
     d->request          = NULL;
     d->isRequestUpdated = iFalse;
     d->media            = new_ObjectList();
@@ -333,6 +349,12 @@ void init_DocumentWidget(iDocumentWidget *d) {
     d->ordinalBase      = 0;
     d->initNormScrollY  = 0;
     init_SmoothScroll(&d->scrollY, w, scrollBegan_DocumentWidget_);
+    d->layoutWorker     = NULL;
+    d->layoutDoc        = NULL;
+    init_String(&d->layoutSource);
+    init_String(&d->pendingLayoutSource);
+    d->layoutWidth      = 0;
+    d->layoutReqId      = 0;
     d->animWideRunId = 0;
     init_Anim(&d->animWideRunOffset, 0);
     d->selectMark       = iNullRange;
@@ -360,6 +382,7 @@ void init_DocumentWidget(iDocumentWidget *d) {
     init_String(&d->sourceMime);
     init_Block(&d->sourceContent, 0);
     iZap(d->sourceTime);
+    iZap(d->hiddenSince);
     d->sourceGempub = NULL;
     init_PtrArray(&d->visibleLinks);
     init_PtrArray(&d->visiblePre);
@@ -368,6 +391,7 @@ void init_DocumentWidget(iDocumentWidget *d) {
     init_PtrArray(&d->visibleMedia);
     d->grabbedPlayer = NULL;
     d->mediaTimer    = 0;
+    d->prefetchTimer = 0;
     init_String(&d->pendingGotoHeading);
     init_Click(&d->click, d, SDL_BUTTON_LEFT);
     addChild_Widget(w, iClob(d->scroll = new_ScrollWidget()));
@@ -395,6 +419,13 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     removeTicker_App(animate_DocumentWidget_, d);
     removeTicker_App(prerender_DocumentWidget_, d);
     remove_Periodic(periodic_App(), d);
+    if (d->layoutWorker) {
+        join_Thread(d->layoutWorker);
+        iRelease(d->layoutWorker);
+    }
+    iRelease(d->layoutDoc);
+    deinit_String(&d->pendingLayoutSource);
+    deinit_String(&d->layoutSource);
     delete_Translation(d->translation);
     delete_DrawBufs(d->drawBufs);
     delete_VisBuf(d->visBuf);
@@ -411,6 +442,9 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     if (d->mediaTimer) {
         SDL_RemoveTimer(d->mediaTimer);
     }
+    if (d->prefetchTimer) {
+        SDL_RemoveTimer(d->prefetchTimer);
+    }
     deinit_Array(&d->wideRunOffsets);
     deinit_PtrArray(&d->visibleMedia);
     deinit_PtrArray(&d->visibleWideRuns);
@@ -419,6 +453,7 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     delete_Block(d->certFingerprint);
     delete_String(d->certSubject);
     delete_String(d->titleUser);
+    delete_String(d->restoredTitle);
     deinit_PersistentDocumentState(&d->mod);
 }
 
@@ -664,6 +699,44 @@ static iBool isHoverAllowed_DocumentWidget_(const iDocumentWidget *d) {
     return iTrue;
 }
 
+static uint32_t postPrefetch_DocumentWidget_(uint32_t interval, void *context) {
+    iUnused(interval);
+    postCommandf_App("document.prefetch doc:%p", context);
+    return 0;
+}
+
+static const iString *prefetchUrl_DocumentWidget_(const iDocumentWidget *d, iGmLinkId linkId) {
+    /* Same form as the URL that will be requested when the link is opened. */
+    return withSpacesEncoded_String(urlFragmentStripped_String(linkUrl_GmDocument(d->doc, linkId)));
+}
+
+static iBool isPrefetchable_DocumentWidget_(const iDocumentWidget *d, iGmLinkId linkId) {
+    const int linkFlags = linkFlags_GmDocument(d->doc, linkId);
+    if (~linkFlags & gemini_GmLinkFlag ||
+        linkFlags & (imageFileExtension_GmLinkFlag | audioFileExtension_GmLinkFlag |
+                     content_GmLinkFlag)) {
+        return iFalse;
+    }
+    const iString *url = linkUrl_GmDocument(d->doc, linkId);
+    return equalRangeCase_Rangecc(urlHost_String(url), urlHost_String(d->mod.url)) &&
+           !equal_String(urlFragmentStripped_String(url), d->mod.url);
+}
+
+static void updatePrefetch_DocumentWidget_(iDocumentWidget *d, const iGmRun *oldHoverLink) {
+    if (d->prefetchTimer) {
+        SDL_RemoveTimer(d->prefetchTimer);
+        d->prefetchTimer = 0;
+    }
+    if (oldHoverLink) {
+        /* The user moved on; no need to finish fetching it. */
+        cancel_GmPrefetch(prefetch_App(), prefetchUrl_DocumentWidget_(d, oldHoverLink->linkId));
+    }
+    if (prefs_App()->prefetchLinks && d->hoverLink &&
+        isPrefetchable_DocumentWidget_(d, d->hoverLink->linkId)) {
+        d->prefetchTimer = SDL_AddTimer(300, postPrefetch_DocumentWidget_, d);
+    }
+}
+
 static void updateHover_DocumentWidget_(iDocumentWidget *d, iInt2 mouse) {
     const iWidget *w            = constAs_Widget(d);
     const iRect    docBounds    = documentBounds_DocumentWidget_(d);
@@ -688,6 +761,7 @@ static void updateHover_DocumentWidget_(iDocumentWidget *d, iInt2 mouse) {
         if (d->hoverLink) {
             invalidateLink_DocumentWidget_(d, d->hoverLink->linkId);
         }
+        updatePrefetch_DocumentWidget_(d, oldHoverLink);
         refresh_Widget(w);
     }
     /* Hovering over preformatted blocks. */
@@ -888,6 +962,11 @@ static void updateVisible_DocumentWidget_(iDocumentWidget *d) {
     }
 }
 
+static const iString *documentTitle_DocumentWidget_(const iDocumentWidget *d) {
+    return d->flags & deferredRestore_DocumentWidgetFlag ? d->restoredTitle
+                                                         : title_GmDocument(d->doc);
+}
+
 static void updateWindowTitle_DocumentWidget_(const iDocumentWidget *d) {
     iLabelWidget *tabButton = tabPageButton_Widget(findChild_Widget(root_Widget(constAs_Widget(d)),
                                                                     "doctabs"), d);
@@ -896,8 +975,8 @@ static void updateWindowTitle_DocumentWidget_(const iDocumentWidget *d) {
         return;
     }
     iStringArray *title = iClob(new_StringArray());
-    if (!isEmpty_String(title_GmDocument(d->doc))) {
-        pushBack_StringArray(title, title_GmDocument(d->doc));
+    if (!isEmpty_String(documentTitle_DocumentWidget_(d))) {
+        pushBack_StringArray(title, documentTitle_DocumentWidget_(d));
     }
     if (!isEmpty_String(d->titleUser)) {
         pushBack_StringArray(title, d->titleUser);
@@ -1016,9 +1095,21 @@ static void showOrHidePinningIndicator_DocumentWidget_(iDocumentWidget *d) {
                          isPinned_DocumentWidget_(d));
 }
 
-void setSource_DocumentWidget(iDocumentWidget *d, const iString *source) {
+static void discardBackgroundLayout_DocumentWidget_(iDocumentWidget *d) {
+    /* A job that is still running will be ignored when it finishes. */
+    d->layoutReqId = 0;
+    d->flags &= ~pendingLayout_DocumentWidgetFlag;
+    clear_String(&d->pendingLayoutSource);
+    if (!d->layoutWorker) {
+        iReleasePtr(&d->layoutDoc);
+    }
+}
+
+static void setSource_DocumentWidget_(iDocumentWidget *d, const iString *source,
+                                      enum iGmDocumentUpdate updateType) {
+    discardBackgroundLayout_DocumentWidget_(d);
     setUrl_GmDocument(d->doc, d->mod.url);
-    setSource_GmDocument(d->doc, source, documentWidth_DocumentWidget_(d));
+    setSource_GmDocument(d->doc, source, documentWidth_DocumentWidget_(d), updateType);
     documentRunsInvalidated_DocumentWidget_(d);
     updateWindowTitle_DocumentWidget_(d);
     updateVisible_DocumentWidget_(d);
@@ -1037,6 +1128,72 @@ void setSource_DocumentWidget(iDocumentWidget *d, const iString *source) {
     showOrHidePinningIndicator_DocumentWidget_(d);
 }
 
+void setSource_DocumentWidget(iDocumentWidget *d, const iString *source) {
+    setSource_DocumentWidget_(d, source, replace_GmDocumentUpdate);
+}
+
+static iThreadResult layout_DocumentWidget_(iThread *thread) {
+    /* Note: Called in a background thread. Only `layoutDoc` may be accessed here. */
+    iDocumentWidget *d = userData_Thread(thread);
+    lockFonts_Text();
+    setSource_GmDocument(d->layoutDoc, &d->layoutSource, d->layoutWidth, append_GmDocumentUpdate);
+    unlockFonts_Text();
+    postCommand_Widget(as_Widget(d), "document.layout.finished");
+    return 0;
+}
+
+static void startBackgroundLayout_DocumentWidget_(iDocumentWidget *d, const iString *source) {
+    iAssert(!d->layoutWorker);
+    setUrl_GmDocument(d->doc, d->mod.url);
+    set_String(&d->layoutSource, source);
+    if (d->layoutDoc) {
+        /* Continue from the layout of the previous job (it was swapped with the shown one). */
+        updateLayoutCopy_GmDocument(d->layoutDoc, d->doc);
+    }
+    else {
+        d->layoutDoc = newLayoutCopy_GmDocument(d->doc);
+    }
+    d->layoutWidth  = documentWidth_DocumentWidget_(d);
+    d->layoutReqId  = id_GmRequest(d->request);
+    d->layoutWorker = new_Thread(layout_DocumentWidget_);
+    setUserData_Thread(d->layoutWorker, d);
+    start_Thread(d->layoutWorker);
+}
+
+static void setSourceInBackground_DocumentWidget_(iDocumentWidget *d, const iString *source) {
+    if (d->layoutWorker) {
+        /* Only the latest content needs to be laid out after the current job. */
+        set_String(&d->pendingLayoutSource, source);
+        d->flags |= pendingLayout_DocumentWidgetFlag;
+        return;
+    }
+    startBackgroundLayout_DocumentWidget_(d, source);
+}
+
+static void finishBackgroundLayout_DocumentWidget_(iDocumentWidget *d) {
+    join_Thread(d->layoutWorker);
+    iReleasePtr(&d->layoutWorker);
+    if (d->layoutReqId && d->layoutReqId == id_GmRequest(d->request) &&
+        d->state == receivedPartialResponse_RequestState) {
+        takeLayout_GmDocument(d->doc, d->layoutDoc);
+        documentRunsInvalidated_DocumentWidget_(d);
+        updateWindowTitle_DocumentWidget_(d);
+        updateVisible_DocumentWidget_(d);
+        d->drawBufs->flags |= updateSideBuf_DrawBufsFlag;
+        invalidate_DocumentWidget_(d);
+        refresh_Widget(as_Widget(d));
+    }
+    else {
+        iReleasePtr(&d->layoutDoc);
+    }
+    clear_String(&d->layoutSource);
+    if (d->flags & pendingLayout_DocumentWidgetFlag) {
+        d->flags &= ~pendingLayout_DocumentWidgetFlag;
+        startBackgroundLayout_DocumentWidget_(d, &d->pendingLayoutSource);
+        clear_String(&d->pendingLayoutSource);
+    }
+}
+
 static void updateTheme_DocumentWidget_(iDocumentWidget *d) {
     if (isEmpty_String(d->titleUser)) {
         setThemeSeed_GmDocument(d->doc,
@@ -1155,6 +1312,11 @@ static void showErrorPage_DocumentWidget_(iDocumentWidget *d, enum iGmStatusCode
     d->state = ready_RequestState;
 }
 
+static size_t sourceSize_DocumentWidget_(const iDocumentWidget *d) {
+    /* The source content is only set when the request finishes. */
+    return d->request ? bodySize_GmRequest(d->request) : size_Block(&d->sourceContent);
+}
+
 static void updateFetchProgress_DocumentWidget_(iDocumentWidget *d) {
     iLabelWidget *prog   = findChild_Widget(root_Widget(as_Widget(d)), "document.progress");
     const size_t  dlSize = d->request ? bodySize_GmRequest(d->request) : 0;
@@ -1354,11 +1516,12 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d, const iGmResponse
         return;
     }
     const iBool isRequestFinished = isFinished_GmRequest(d->request);
-    /* TODO: Do document update in the background. However, that requires a text metrics calculator
-       that does not try to cache the glyph bitmaps. */
     const enum iGmStatusCode statusCode = response->statusCode;
     if (category_GmStatusCode(statusCode) != categoryInput_GmStatusCode) {
         iBool setSource = iTrue;
+        /* More of the same response has arrived, so only the new lines need layout. */
+        enum iGmDocumentUpdate updateType =
+            isInitialUpdate ? replace_GmDocumentUpdate : append_GmDocumentUpdate;
         iString str;
         invalidate_DocumentWidget_(d);
         if (document_App() == d) {
@@ -1367,7 +1530,13 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d, const iGmResponse
         clear_String(&d->sourceMime);
         d->sourceTime = response->when;
         d->drawBufs->flags |= updateTimestampBuf_DrawBufsFlag;
-        initBlock_String(&str, &response->body);
+        init_String(&str);
+        if (!isSuccess_GmStatusCode(statusCode) ||
+            (!startsWithCase_String(&response->meta, "image/") &&
+             !startsWithCase_String(&response->meta, "audio/"))) {
+            /* Media data is passed to Media as is, not via the source. */
+            getData_GmBody(&response->body, &str.chars);
+        }
         if (isSuccess_GmStatusCode(statusCode)) {
             /* Check the MIME type. */
             iRangecc charset = range_CStr("utf-8");
@@ -1394,6 +1563,7 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d, const iGmResponse
                          (startsWith_Rangecc(param, "application/") &&
                           endsWithCase_Rangecc(param, "+zip"))) {
                     docFormat = gemini_GmDocumentFormat;
+                    updateType = replace_GmDocumentUpdate; /* generated page */
                     setRange_String(&d->sourceMime, param);
                     iString *key = collectNew_String();
                     toString_Sym(SDLK_s, KMOD_PRIMARY, key);
@@ -1421,6 +1591,7 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d, const iGmResponse
                     const iBool isAudio = startsWith_Rangecc(param, "audio/");
                     /* Make a simple document with an image or audio player. */
                     docFormat = gemini_GmDocumentFormat;
+                    updateType = replace_GmDocumentUpdate; /* generated page */
                     setRange_String(&d->sourceMime, param);
                     const iGmLinkId imgLinkId = 1; /* there's only the one link */
                     if ((isAudio && isInitialUpdate) || (!isAudio && isRequestFinished)) {
@@ -1479,13 +1650,23 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d, const iGmResponse
             }
         }
         if (setSource) {
-            setSource_DocumentWidget(d, &str);
+            if (updateType == append_GmDocumentUpdate && !isRequestFinished &&
+                size_String(&str) >= backgroundLayoutMinSize_DocumentWidget_ &&
+                isEmpty_ObjectList(d->media)) {
+                /* Large pages are laid out in the background while they are streaming in so
+                   the UI remains responsive. Inline media is only laid out synchronously. */
+                setSourceInBackground_DocumentWidget_(d, &str);
+            }
+            else {
+                setSource_DocumentWidget_(d, &str, updateType);
+            }
         }
         deinit_String(&str);
     }
 }
 
 static void fetch_DocumentWidget_(iDocumentWidget *d) {
+    d->flags &= ~deferredRestore_DocumentWidgetFlag;
     /* Forget the previous request. */
     if (d->request) {
         iRelease(d->request);
@@ -1553,12 +1734,15 @@ static void cacheDocumentGlyphs_DocumentWidget_(const iDocumentWidget *d) {
         if (maxY == 0) {
             maxY = size_GmDocument(d->doc).y;
         }
+        setAsyncGlyphs_Text(iTrue);
         render_GmDocument(d->doc, (iRangei){ 0, maxY }, cacheRunGlyphs_, NULL);
+        setAsyncGlyphs_Text(iFalse);
     }
 }
 
 static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float normScrollY,
                                                      const iGmResponse *resp) {
+    d->flags &= ~deferredRestore_DocumentWidgetFlag;
     setLinkNumberMode_DocumentWidget_(d, iFalse);
     clear_ObjectList(d->media);
     delete_Gempub(d->sourceGempub);
@@ -1575,7 +1759,7 @@ static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float n
         d->sourceTime   = resp->when;
         d->sourceStatus = success_GmStatusCode;
         format_String(&d->sourceHeader, cstr_Lang("pageinfo.header.cached"));
-        set_Block(&d->sourceContent, &resp->body);
+        getData_GmBody(&resp->body, &d->sourceContent);
         updateDocument_DocumentWidget_(d, resp, iTrue);
         postProcessRequestContent_DocumentWidget_(d, iTrue);
     }
@@ -1598,7 +1782,16 @@ static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
         updateFromCachedResponse_DocumentWidget_(d, recent->normScrollY, recent->cachedResponse);
         return iTrue;
     }
-    else if (!isEmpty_String(d->mod.url)) {
+    if (recent) {
+        /* Fall back to the disk cache if the response was dropped from memory. */
+        iGmResponse *resp = load_GmCache(cache_App(), &recent->url);
+        if (resp) {
+            updateFromCachedResponse_DocumentWidget_(d, recent->normScrollY, resp);
+            delete_GmResponse(resp);
+            return iTrue;
+        }
+    }
+    if (!isEmpty_String(d->mod.url)) {
         fetch_DocumentWidget_(d);
     }
     if (recent) {
@@ -1608,6 +1801,18 @@ static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
     return iFalse;
 }
 
+static iBool updateFromPrefetch_DocumentWidget_(iDocumentWidget *d) {
+    iGmResponse *resp = take_GmPrefetch(prefetch_App(), withSpacesEncoded_String(d->mod.url));
+    if (!resp) {
+        return iFalse;
+    }
+    iReleasePtr(&d->request);
+    updateFromCachedResponse_DocumentWidget_(d, 0.0f, resp);
+    setCachedResponse_History(d->mod.history, resp);
+    delete_GmResponse(resp);
+    return iTrue;
+}
+
 static void refreshWhileScrolling_DocumentWidget_(iAny *ptr) {
     iDocumentWidget *d = ptr;
     updateVisible_DocumentWidget_(d);
@@ -1965,7 +2170,10 @@ static iMediaRequest *findMediaRequest_DocumentWidget_(const iDocumentWidget *d,
 static iBool requestMedia_DocumentWidget_(iDocumentWidget *d, iGmLinkId linkId, iBool enableFilters) {
     if (!findMediaRequest_DocumentWidget_(d, linkId)) {
         const iString *mediaUrl = absoluteUrl_String(d->mod.url, linkUrl_GmDocument(d->doc, linkId));
-        pushBack_ObjectList(d->media, iClob(new_MediaRequest(d, linkId, mediaUrl, enableFilters)));
+        const iBool isDownload =
+            findLinkDownload_Media(constMedia_GmDocument(d->doc), linkId) != 0;
+        pushBack_ObjectList(
+            d->media, iClob(new_MediaRequest(d, linkId, mediaUrl, enableFilters, isDownload)));
         invalidate_DocumentWidget_(d);
         return iTrue;
     }
@@ -2025,7 +2233,7 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
                 setData_Media(media_GmDocument(d->doc),
                               req->linkId,
                               meta_GmRequest(req->req),
-                              body_GmRequest(req->req),
+                              chunkedBody_GmRequest(req->req),
                               allowHide_MediaFlag);
                 redoLayout_GmDocument(d->doc);
                 updateVisible_DocumentWidget_(d);
@@ -2265,6 +2473,11 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         invalidate_DocumentWidget_(d);
         refresh_Widget(w);
     }
+    else if (equal_Command(cmd, "text.glyphs.ready")) {
+        /* Some of the runs may have been drawn without all their glyphs. */
+        invalidate_DocumentWidget_(d);
+        return iFalse;
+    }
     else if (equal_Command(cmd, "document.layout.changed") && document_App() == d) {
         updateSize_DocumentWidget(d);
     }
@@ -2279,6 +2492,13 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     else if (equal_Command(cmd, "tabs.changed")) {
         setLinkNumberMode_DocumentWidget_(d, iFalse);
         if (cmp_String(id_Widget(w), suffixPtr_Command(cmd, "id")) == 0) {
+            iZap(d->hiddenSince);
+            if (d->flags & deferredRestore_DocumentWidgetFlag) {
+                /* Shown for the first time since the session was restored or the tab
+                   was hibernated. */
+                d->flags &= ~deferredRestore_DocumentWidgetFlag;
+                updateFromHistory_DocumentWidget_(d);
+            }
             /* Set palette for our document. */
             updateTheme_DocumentWidget_(d);
             updateTrust_DocumentWidget_(d, NULL);
@@ -2286,6 +2506,9 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             showOrHidePinningIndicator_DocumentWidget_(d);
             updateFetchProgress_DocumentWidget_(d);
         }
+        else if (!isVisible_Widget(w) && !isValid_Time(&d->hiddenSince)) {
+            initCurrent_Time(&d->hiddenSince);
+        }
         init_Anim(&d->sideOpacity, 0);
         init_Anim(&d->altTextOpacity, 0);
         updateSideOpacity_DocumentWidget_(d, iFalse);
@@ -2338,13 +2561,13 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             appendFormat_String(msg,
                                 "%s\n%s\n",
                                 cstr_String(meta),
-                                formatCStrs_Lang("num.bytes.n", size_Block(&d->sourceContent)));
+                                formatCStrs_Lang("num.bytes.n", sourceSize_DocumentWidget_(d)));
         }
         else {
             appendFormat_String(msg, "%s\n", cstr_String(&d->sourceHeader));
-            if (size_Block(&d->sourceContent)) {
+            if (sourceSize_DocumentWidget_(d)) {
                 appendFormat_String(
-                    msg, "%s\n", formatCStrs_Lang("num.bytes.n", size_Block(&d->sourceContent)));
+                    msg, "%s\n", formatCStrs_Lang("num.bytes.n", sourceSize_DocumentWidget_(d)));
             }
         }
         appendFormat_String(
@@ -2487,8 +2710,8 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     }
     else if (equalWidget_Command(cmd, w, "document.request.updated") &&
              id_GmRequest(d->request) == argU32Label_Command(cmd, "reqid")) {
-        set_Block(&d->sourceContent, &lockResponse_GmRequest(d->request)->body);
-        unlockResponse_GmRequest(d->request);
+        /* Note: The source content is set when the request finishes; sharing the partial body
+           would force it to be copied when more data arrives. */
         if (document_App() == d) {
             updateFetchProgress_DocumentWidget_(d);
         }
@@ -2496,6 +2719,10 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         set_Atomic(&d->isRequestUpdated, iFalse); /* ready to be notified again */
         return iFalse;
     }
+    else if (equalWidget_Command(cmd, w, "document.layout.finished") && d->layoutWorker) {
+        finishBackgroundLayout_DocumentWidget_(d);
+        return iTrue;
+    }
     else if (equalWidget_Command(cmd, w, "document.request.finished") &&
              id_GmRequest(d->request) == argU32Label_Command(cmd, "reqid")) {
         set_Block(&d->sourceContent, body_GmRequest(d->request));
@@ -2521,7 +2748,9 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             if (!equal_Rangecc(urlScheme_String(d->mod.url), "about") &&
                 (startsWithCase_String(meta_GmRequest(d->request), "text/") ||
                  !cmp_String(&d->sourceMime, mimeType_Gempub))) {
-                setCachedResponse_History(d->mod.history, lockResponse_GmRequest(d->request));
+                const iGmResponse *resp = lockResponse_GmRequest(d->request);
+                setCachedResponse_History(d->mod.history, resp);
+                store_GmCache(cache_App(), withSpacesEncoded_String(d->mod.url), resp);
                 unlockResponse_GmRequest(d->request);
             }
         }
@@ -2850,6 +3079,21 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             }
         }
     }
+    else if (equal_Command(cmd, "document.prefetch") && document_Command(cmd) == d) {
+        d->prefetchTimer = 0;
+        if (d->hoverLink && d->state == ready_RequestState) {
+            start_GmPrefetch(prefetch_App(), prefetchUrl_DocumentWidget_(d, d->hoverLink->linkId));
+        }
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "document.hibernate")) {
+        const int minutes = prefs_App()->hibernateAfter;
+        if (minutes > 0 && isValid_Time(&d->hiddenSince) &&
+            elapsedSeconds_Time(&d->hiddenSince) >= minutes * 60) {
+            hibernate_DocumentWidget(d);
+        }
+        return iFalse;
+    }
     else if (equal_Command(cmd, "document.autoreload.menu") && document_App() == d) {
         iArray *items = collectNew_Array(sizeof(iMenuItem));
         for (int i = 0; i < max_ReloadInterval; ++i) {
@@ -3576,7 +3820,7 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                                     setData_Media(media_GmDocument(d->doc),
                                                   linkId,
                                                   meta_GmRequest(req->req),
-                                                  body_GmRequest(req->req),
+                                                  chunkedBody_GmRequest(req->req),
                                                   allowHide_MediaFlag);
                                     redoLayout_GmDocument(d->doc);
                                     updateVisible_DocumentWidget_(d);
@@ -4421,10 +4665,12 @@ static void prerender_DocumentWidget_(iAny *context) {
     };
 //    printf("%u prerendering\n", SDL_GetTicks());
     if (d->visBuf->buffers[0].texture) {
+        setAsyncGlyphs_Text(iTrue);
         if (render_DocumentWidget_(d, &ctx, iTrue /* just fill up progressively */)) {
             /* Something was drawn, should check if there is still more to do. */
             addTicker_App(prerender_DocumentWidget_, context);
         }
+        setAsyncGlyphs_Text(iFalse);
     }
 }
 
@@ -4449,7 +4695,9 @@ static void draw_DocumentWidget_(const iDocumentWidget *d) {
         .vis             = vis,
         .showLinkNumbers = (d->flags & showLinkNumbers_DocumentWidgetFlag) != 0,
     };
+    setAsyncGlyphs_Text(iTrue); /* missing glyphs will be drawn once they arrive */
     render_DocumentWidget_(d, &ctx, iFalse /* just the mandatory parts */);
+    setAsyncGlyphs_Text(iFalse);
     setClip_Paint(&ctx.paint, bounds);
     int yTop = docBounds.pos.y - pos_SmoothScroll(&d->scrollY);
     draw_VisBuf(d->visBuf, init_I2(bounds.pos.x, yTop), ySpan_Rect(bounds));
@@ -4593,8 +4841,8 @@ const iString *feedTitle_DocumentWidget(const iDocumentWidget *d) {
 
 const iString *bookmarkTitle_DocumentWidget(const iDocumentWidget *d) {
     iStringArray *title = iClob(new_StringArray());
-    if (!isEmpty_String(title_GmDocument(d->doc))) {
-        pushBack_StringArray(title, title_GmDocument(d->doc));
+    if (!isEmpty_String(documentTitle_DocumentWidget_(d))) {
+        pushBack_StringArray(title, documentTitle_DocumentWidget_(d));
     }
     if (!isEmpty_String(d->titleUser)) {
         pushBack_StringArray(title, d->titleUser);
@@ -4612,14 +4860,82 @@ const iString *bookmarkTitle_DocumentWidget(const iDocumentWidget *d) {
     return collect_String(joinCStr_StringArray(title, " \u2014 "));
 }
 
+static iBool isMediaActive_DocumentWidget_(const iDocumentWidget *d) {
+    iConstForEach(ObjectList, i, d->media) {
+        const iMediaRequest *mr = i.object;
+        if (!isFinished_GmRequest(mr->req)) {
+            return iTrue; /* still downloading */
+        }
+    }
+    const iMedia *media = media_GmDocument(d->doc);
+    for (size_t id = 1; id <= numAudio_Media(media); id++) {
+        const iPlayer *plr = audioPlayer_Media(media, id);
+        if (plr && isStarted_Player(plr) && !isPaused_Player(plr)) {
+            return iTrue;
+        }
+    }
+    return iFalse;
+}
+
+iBool hibernate_DocumentWidget(iDocumentWidget *d) {
+    if (d->flags & deferredRestore_DocumentWidgetFlag) {
+        return iTrue; /* nothing loaded */
+    }
+    const iRecentUrl  *recent = mostRecentUrl_History(d->mod.history);
+    const iGmResponse *resp   = cachedResponse_History(d->mod.history);
+    if (isVisible_Widget(d) || d->state != ready_RequestState || d->request || !recent ||
+        !resp || isMediaActive_DocumentWidget_(d)) {
+        return iFalse;
+    }
+    /* The page will be rebuilt from the cached response when the tab is shown again. Keep a
+       copy on disk in case the memory cache is trimmed while the tab is hibernating; without
+       one, the page stays loaded. */
+    if (!store_GmCache(cache_App(), &recent->url, resp)) {
+        return iFalse;
+    }
+    set_String(d->restoredTitle, title_GmDocument(d->doc));
+    setLinkNumberMode_DocumentWidget_(d, iFalse);
+    clear_ObjectList(d->media);
+    delete_Gempub(d->sourceGempub);
+    d->sourceGempub = NULL;
+    reset_GmDocument(d->doc);
+    documentRunsInvalidated_DocumentWidget_(d);
+    clear_PtrArray(&d->visibleLinks);
+    clear_PtrArray(&d->visibleWideRuns);
+    clear_PtrArray(&d->visiblePre);
+    clear_PtrArray(&d->visibleMedia);
+    clear_PtrSet(d->invalidRuns);
+    destroy_Widget(d->footerButtons);
+    d->footerButtons = NULL;
+    resetWideRuns_DocumentWidget_(d);
+    clear_Block(&d->sourceContent);
+    dealloc_VisBuf(d->visBuf);
+    remove_Periodic(periodic_App(), d);
+    removeTicker_App(prerender_DocumentWidget_, d);
+    d->flags |= deferredRestore_DocumentWidgetFlag;
+    return iTrue;
+}
+
 void serializeState_DocumentWidget(const iDocumentWidget *d, iStream *outs) {
     serialize_PersistentDocumentState(&d->mod, outs);
+    serialize_String(documentTitle_DocumentWidget_(d), outs);
 }
 
-void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins) {
+void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins, iBool isDeferred) {
     deserialize_PersistentDocumentState(&d->mod, ins);
+    clear_String(d->restoredTitle);
+    if (version_Stream(ins) >= savedTabTitles_FileVersion) {
+        deserialize_String(d->restoredTitle, ins);
+    }
     parseUser_DocumentWidget_(d);
-    updateFromHistory_DocumentWidget_(d);
+    if (isDeferred && !isEmpty_String(d->mod.url)) {
+        /* Only the title is needed for the tab button until the tab is switched to. */
+        d->flags |= deferredRestore_DocumentWidgetFlag;
+        updateWindowTitle_DocumentWidget_(d);
+    }
+    else {
+        updateFromHistory_DocumentWidget_(d);
+    }
 }
 
 static void setUrl_DocumentWidget_(iDocumentWidget *d, const iString *url) {
@@ -4635,7 +4951,9 @@ void setUrlFromCache_DocumentWidget(iDocumentWidget *d, const iString *url, iBoo
     /* See if there a username in the URL. */
     parseUser_DocumentWidget_(d);
     if (!isFromCache || !updateFromHistory_DocumentWidget_(d)) {
-        fetch_DocumentWidget_(d);
+        if (!updateFromPrefetch_DocumentWidget_(d)) {
+            fetch_DocumentWidget_(d);
+        }
     }
 }
 
@@ -4648,7 +4966,7 @@ void setUrlAndSource_DocumentWidget(iDocumentWidget *d, const iString *url, cons
     resp->statusCode = success_GmStatusCode;
     initCurrent_Time(&resp->when);
     set_String(&resp->meta, mime);
-    set_Block(&resp->body, source);
+    set_GmBody(&resp->body, source);
     updateFromCachedResponse_DocumentWidget_(d, 0, resp);
     delete_GmResponse(resp);
 }
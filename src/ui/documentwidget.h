@@ -32,10 +32,11 @@ iDeclareWidgetClass(DocumentWidget)
 iDeclareObjectConstruction(DocumentWidget)
 
 void    serializeState_DocumentWidget   (const iDocumentWidget *, iStream *outs);
-void    deserializeState_DocumentWidget (iDocumentWidget *, iStream *ins);
+void    deserializeState_DocumentWidget (iDocumentWidget *, iStream *ins, iBool isDeferred); /* deferred: load when first shown */
 
 iDocumentWidget *   duplicate_DocumentWidget        (const iDocumentWidget *);
 iHistory *          history_DocumentWidget          (iDocumentWidget *);
+iBool               hibernate_DocumentWidget        (iDocumentWidget *); /* if hidden and idle */
 
 const iString *     url_DocumentWidget              (const iDocumentWidget *);
 iBool               isRequestOngoing_DocumentWidget (const iDocumentWidget *);
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "command.h"
 #include "documentwidget.h"
 #include "feeds.h"
+#include "gmcache.h"
 #include "gmcerts.h"
 #include "gmutil.h"
 #include "gmdocument.h"
@@ -903,6 +904,7 @@ iBool handleBookmarkEditorCommands_SidebarWidget_(iWidget *editor, const char *c
                                     isSelected_Widget(findChild_Widget(editor, "bmed.tag.remote")));
             addOrRemoveTag_Bookmark(bm, linkSplit_BookmarkTag,
                                     isSelected_Widget(findChild_Widget(editor, "bmed.tag.linksplit")));
+            reindex_Bookmarks(bookmarks_App());
             postCommand_App("bookmarks.changed");
         }
         setupSheetTransition_Mobile(editor, iFalse);
@@ -1146,6 +1148,7 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
                 else {
                     addTag_Bookmark(bm, tag);
                 }
+                reindex_Bookmarks(bookmarks_App());
                 postCommand_App("bookmarks.changed");
             }
             return iTrue;
@@ -1341,6 +1344,7 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
         else if (isCommand_Widget(w, ev, "history.delete")) {
             if (d->contextItem && !isEmpty_String(&d->contextItem->url)) {
                 removeUrl_Visited(visited_App(), &d->contextItem->url);
+                remove_GmCache(cache_App(), &d->contextItem->url);
                 updateItems_SidebarWidget_(d);
                 scrollOffset_ListWidget(d->list, 0);
             }
@@ -1376,6 +1380,7 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
             }
             else {
                 clear_Visited(visited_App());
+                clear_GmCache(cache_App());
                 updateItems_SidebarWidget_(d);
                 scrollOffset_ListWidget(d->list, 0);
             }
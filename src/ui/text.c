@@ -26,6 +26,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "embedded.h"
 #include "window.h"
 #include "app.h"
+#include "gmutil.h"
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "../stb_truetype.h"
@@ -35,14 +36,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/hash.h>
 #include <the_Foundation/math.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/stringlist.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrset.h>
+#include <the_Foundation/thread.h>
 #include <the_Foundation/vec2.h>
 
+#include <SDL_cpuinfo.h>
 #include <SDL_surface.h>
 #include <SDL_hints.h>
+#include <SDL_thread.h>
 #include <SDL_version.h>
 #include <stdarg.h>
 
@@ -54,6 +59,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #   define LAGRANGE_RASTER_FORMAT   SDL_PIXELFORMAT_RGBA8888
 #endif
 
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#   define LAGRANGE_GLYPH_BATCHING  /* glyph quads are drawn with SDL_RenderGeometry */
+#endif
+
 iDeclareType(Font)
 iDeclareType(Glyph)
 iDeclareTypeConstructionArgs(Glyph, iChar ch)
@@ -67,6 +76,8 @@ int enableKerning_Text         = iTrue; /* looking up kern pairs is slow */
 enum iGlyphFlag {
     rasterized0_GlyphFlag = iBit(1),    /* zero offset */
     rasterized1_GlyphFlag = iBit(2),    /* half-pixel offset */
+    pending0_GlyphFlag    = iBit(3),    /* zero offset being rasterized in the background */
+    pending1_GlyphFlag    = iBit(4),    /* half-pixel offset being rasterized in the background */
 };
 
 struct Impl_Glyph {
@@ -74,6 +85,7 @@ struct Impl_Glyph {
     int flags;
     uint32_t glyphIndex;
     iFont *font; /* may come from symbols/emoji */
+    int page; /* glyph cache page */
     iRect rect[2]; /* zero and half pixel offset */
     iInt2 d[2];
     float advance; /* scaled */
@@ -84,6 +96,7 @@ void init_Glyph(iGlyph *d, iChar ch) {
     d->flags      = 0;
     d->glyphIndex = 0;
     d->font       = NULL;
+    d->page       = 0;
     d->rect[0]    = zero_Rect();
     d->rect[1]    = zero_Rect();
     d->advance    = 0.0f;
@@ -106,8 +119,8 @@ iLocalDef iBool isFullyRasterized_Glyph_(const iGlyph *d) {
            (rasterized0_GlyphFlag | rasterized1_GlyphFlag);
 }
 
-iLocalDef void setRasterized_Glyph_(iGlyph *d, int hoff) {
-    d->flags |= rasterized0_GlyphFlag << hoff;
+iLocalDef iBool isPending_Glyph_(const iGlyph *d, int hoff) {
+    return (d->flags & (pending0_GlyphFlag << hoff)) != 0;
 }
 
 iDefineTypeConstructionArgs(Glyph, (iChar ch), ch)
@@ -126,8 +139,22 @@ struct Impl_Font {
     iBool          manualKernOnly;
     enum iFontSize sizeId;  /* used to look up different fonts of matching size */
     uint32_t       indexTable[128 - 32]; /* quick ASCII lookup */
+    uint32_t       cacheKey; /* identifies the data, size, and scaling of the font */
 };
 
+static uint32_t fontCacheKey_(const iFont *d, const iBlock *data) {
+    /* A TrueType file begins with a table directory including checksums for all the tables,
+       so there is no need to hash all of the (possibly very large) data. */
+    const uint32_t dataSize = size_Block(data);
+    uint32_t key = hash32_Data(initial32_Hash, &dataSize, sizeof(dataSize));
+    key = hash32_Data(key, constData_Block(data), iMin(dataSize, 4096u));
+    key = hash32_Data(key, &d->height, sizeof(d->height));
+    key = hash32_Data(key, &d->xScale, sizeof(d->xScale));
+    key = hash32_Data(key, &d->yScale, sizeof(d->yScale));
+    key = hash32_Data(key, &d->vertOffset, sizeof(d->vertOffset));
+    return key;
+}
+
 static iFont *font_Text_(enum iFontId id);
 
 static void init_Font(iFont *d, const iBlock *data, int height, float scale,
@@ -164,6 +191,7 @@ static void init_Font(iFont *d, const iBlock *data, int height, float scale,
     }
     d->sizeId = sizeId;
     memset(d->indexTable, 0xff, sizeof(d->indexTable));
+    d->cacheKey = fontCacheKey_(d, data);
 }
 
 static void clearGlyphs_Font_(iFont *d) {
@@ -195,30 +223,115 @@ static uint32_t glyphIndex_Font_(iFont *d, iChar ch) {
 
 iDeclareType(Text)
 iDeclareType(CacheRow)
+iDeclareType(CachePage)
+iDeclareType(RasterJob)
+iDeclareType(DiskGlyph)
 
 struct Impl_CacheRow {
     int   height;
     iInt2 pos;
 };
 
+struct Impl_CachePage {
+    SDL_Texture *texture;
+    iArray       rows; /* CacheRows for each row height */
+    int          bottom;
+    uint32_t     lastUsed; /* `useCounter` when the page was last drawn from or added to */
+    size_t       numGlyphs;
+};
+
+struct Impl_RasterJob {
+    iFont *  font;
+    iChar    ch;
+    int      hoff;
+    uint32_t glyphIndex;
+    uint8_t *bmp; /* result; allocated by stb_truetype */
+    iInt2    size;
+};
+
+#define maxRasterWorkers_Text_  3
+
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+/* Rasterized glyph bitmaps and metrics kept on disk between launches. */
+struct Impl_DiskGlyph {
+    iHashNode node;
+    uint32_t  fontKey;
+    uint32_t  glyphIndex;
+    int       hoff;
+    iBool     isUsed; /* unused glyphs are dropped when the cache is saved */
+    iInt2     size;
+    iInt2     offset; /* cf. `d` in Glyph */
+    float     advance;
+    uint8_t * bmp;
+};
+
+static const char *diskGlyphsFileName_Text_ = "glyphs.bin";
+static const char *magicDiskGlyphs_Text_    = "lgGl";
+static const size_t maxDiskGlyphs_Text_     = 4096;
+#endif
+
 struct Impl_Text {
     enum iTextFont contentFont;
     enum iTextFont headingFont;
     float          contentFontSize;
     iFont          fonts[max_FontId];
     SDL_Renderer * render;
-    SDL_Texture *  cache;
-    iInt2          cacheSize;
+    iArray         cachePages;   /* CachePages; the glyph cache grows one page at a time */
+    int            maxCachePages;
+    int            cachePage;    /* where new glyphs are placed */
+    iInt2          cacheSize;    /* of each page */
     int            cacheRowAllocStep;
-    int            cacheBottom;
-    iArray         cacheRows;
+    SDL_Color      cacheColor;   /* color and alpha modulation of all pages */
+    SDL_BlendMode  cacheBlend;
+    uint32_t       useCounter;
+    size_t         numEvictions;  /* pages whose glyphs have been discarded */
+    size_t         numRasterized; /* glyphs copied to the cache */
     SDL_Palette *  grayscale;
     iRegExp *      ansiEscape;
+    SDL_threadID   mainThread;
+    iMutex *       glyphsMutex; /* guards glyph hashes against background measuring */
+    iMutex *       fontsMutex;  /* held by background threads while they measure text */
+    iThread *      rasterWorkers[maxRasterWorkers_Text_];
+    int            numRasterWorkers;
+    iMutex *       rasterMutex;
+    iCondition     rasterAvailable;  /* wakes up the raster workers */
+    iCondition     rasterIdle;       /* a worker has finished a job */
+    iArray         rasterQueue;      /* RasterJobs waiting for a worker */
+    iArray         rasterDone;       /* RasterJobs waiting to be uploaded to the cache */
+    int            numRasterBusy;
+    iBool          isRasterStopping;
+    iBool          isRasterNotified; /* "text.glyphs.ready" has been posted */
+    iBool          isAsyncRaster;    /* missing glyphs may be drawn later */
+    size_t         numRasterAsync;   /* glyphs rasterized in the background */
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+    iHash          diskGlyphs;
+    iBool          isDiskGlyphsLoaded; /* loaded when first needed */
+    iBool          isDiskGlyphsChanged;
+    size_t         numDiskGlyphsUsed;
+#endif
+#if defined (LAGRANGE_GLYPH_BATCHING)
+    iArray         batchVerts;   /* SDL_Vertex; glyphs waiting to be drawn */
+    iArray         batchIndices; /* int */
+    int            batchPage;    /* all glyphs of a batch are from the same cache page */
+#endif
+    size_t         numDrawCalls; /* glyph draw calls, for performance statistics */
 };
 
 static iText   text_;
 static iBlock *userFont_;
 
+static void setFlags_Glyph_(iGlyph *d, int set, int clear) {
+    /* Background threads copy glyphs while holding `glyphsMutex`. Only the main thread
+       modifies glyphs, so it can read the flags without locking. */
+    lock_Mutex(text_.glyphsMutex);
+    d->flags = (d->flags | set) & ~clear;
+    unlock_Mutex(text_.glyphsMutex);
+}
+
+static void setRasterized_Glyph_(iGlyph *d, int hoff) {
+    setFlags_Glyph_(d, rasterized0_GlyphFlag << hoff, pending0_GlyphFlag << hoff);
+}
+
 static void initFonts_Text_(iText *d) {
     const float textSize = fontSize_UI * d->contentFontSize;
     const float monoSize = textSize * 0.71f;
@@ -374,8 +487,37 @@ static int maxGlyphHeight_Text_(const iText *d) {
     return 2 * d->contentFontSize * fontSize_UI;
 }
 
+static void initPage_Text_(iText *d, iCachePage *page) {
+    const int textSize = d->contentFontSize * fontSize_UI;
+    init_Array(&page->rows, sizeof(iCacheRow));
+    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
+       once at least one glyph is stored. */
+    for (int h = d->cacheRowAllocStep; h <= 2 * textSize + d->cacheRowAllocStep; h += d->cacheRowAllocStep) {
+        pushBack_Array(&page->rows, &(iCacheRow){ .height = 0 });
+    }
+    page->bottom    = 0;
+    page->lastUsed  = d->useCounter;
+    page->numGlyphs = 0;
+}
+
+static void addPage_Text_(iText *d) {
+    iCachePage page;
+    initPage_Text_(d, &page);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    page.texture = SDL_CreateTexture(d->render,
+                                     SDL_PIXELFORMAT_RGBA4444,
+                                     SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
+                                     d->cacheSize.x,
+                                     d->cacheSize.y);
+    SDL_SetTextureBlendMode(page.texture, d->cacheBlend);
+    SDL_SetTextureColorMod(page.texture, d->cacheColor.r, d->cacheColor.g, d->cacheColor.b);
+    SDL_SetTextureAlphaMod(page.texture, d->cacheColor.a);
+    pushBack_Array(&d->cachePages, &page);
+    d->cachePage = size_Array(&d->cachePages) - 1;
+}
+
 static void initCache_Text_(iText *d) {
-    init_Array(&d->cacheRows, sizeof(iCacheRow));
+    init_Array(&d->cachePages, sizeof(iCachePage));
     const int textSize = d->contentFontSize * fontSize_UI;
     iAssert(textSize > 0);
     const iInt2 cacheDims = init_I2(16, 40);
@@ -386,28 +528,307 @@ static void initCache_Text_(iText *d) {
         d->cacheSize.y = renderInfo.max_texture_height;
         d->cacheSize.x = renderInfo.max_texture_width;
     }
+    /* More pages are added as needed, until they would take up as much space as the largest
+       texture supported by the renderer. */
+    d->maxCachePages = renderInfo.max_texture_height > 0
+                           ? iClamp(renderInfo.max_texture_height / d->cacheSize.y, 2, 8)
+                           : 4;
     d->cacheRowAllocStep = iMax(2, textSize / 6);
-    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
-       once at least one glyph is stored. */
-    for (int h = d->cacheRowAllocStep; h <= 2 * textSize + d->cacheRowAllocStep; h += d->cacheRowAllocStep) {
-        pushBack_Array(&d->cacheRows, &(iCacheRow){ .height = 0 });
-    }
-    d->cacheBottom = 0;
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
-    d->cache = SDL_CreateTexture(d->render,
-                                 SDL_PIXELFORMAT_RGBA4444,
-                                 SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
-                                 d->cacheSize.x,
-                                 d->cacheSize.y);
-    SDL_SetTextureBlendMode(d->cache, SDL_BLENDMODE_BLEND);
+    d->cacheColor        = (SDL_Color){ 255, 255, 255, 255 };
+    d->cacheBlend        = SDL_BLENDMODE_BLEND;
+    addPage_Text_(d);
 }
 
 static void deinitCache_Text_(iText *d) {
-    deinit_Array(&d->cacheRows);
-    SDL_DestroyTexture(d->cache);
+    iForEach(Array, i, &d->cachePages) {
+        iCachePage *page = i.value;
+        deinit_Array(&page->rows);
+        SDL_DestroyTexture(page->texture);
+    }
+    deinit_Array(&d->cachePages);
+}
+
+iLocalDef iCachePage *cachePage_Text_(iText *d, int index) {
+    return at_Array(&d->cachePages, index);
 }
 
+static void setCacheColor_Text_(iText *d, iColor clr) {
+    d->cacheColor = (SDL_Color){ clr.r, clr.g, clr.b, d->cacheColor.a };
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureColorMod(((iCachePage *) i.value)->texture, clr.r, clr.g, clr.b);
+    }
+}
+
+static void setCacheAlpha_Text_(iText *d, uint8_t alpha) {
+    d->cacheColor.a = alpha;
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureAlphaMod(((iCachePage *) i.value)->texture, alpha);
+    }
+}
+
+static void setCacheBlendMode_Text_(iText *d, SDL_BlendMode mode) {
+    d->cacheBlend = mode;
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureBlendMode(((iCachePage *) i.value)->texture, mode);
+    }
+}
+
+static void freeRasterJobs_(iArray *jobs) {
+    iForEach(Array, i, jobs) {
+        stbtt_FreeBitmap(((iRasterJob *) i.value)->bmp, NULL);
+    }
+    clear_Array(jobs);
+}
+
+static iThreadResult rasterize_Text_(iThread *thread) {
+    iText *d = userData_Thread(thread);
+    lock_Mutex(d->rasterMutex);
+    for (;;) {
+        while (isEmpty_Array(&d->rasterQueue) && !d->isRasterStopping) {
+            wait_Condition(&d->rasterAvailable, d->rasterMutex);
+        }
+        if (d->isRasterStopping) {
+            break;
+        }
+        iRasterJob job = *(const iRasterJob *) constFront_Array(&d->rasterQueue);
+        popFront_Array(&d->rasterQueue);
+        d->numRasterBusy++;
+        unlock_Mutex(d->rasterMutex);
+        /* stb_truetype only reads the font info, so glyphs can be rasterized concurrently.
+           The main thread does not modify fonts while jobs are in progress. */
+        job.bmp = stbtt_GetGlyphBitmapSubpixel(&job.font->font,
+                                               job.font->xScale,
+                                               job.font->yScale,
+                                               job.hoff * 0.5f,
+                                               0.0f,
+                                               job.glyphIndex,
+                                               &job.size.x,
+                                               &job.size.y,
+                                               0,
+                                               0);
+        lock_Mutex(d->rasterMutex);
+        pushBack_Array(&d->rasterDone, &job);
+        d->numRasterBusy--;
+        signal_Condition(&d->rasterIdle);
+        if (!d->isRasterNotified) {
+            d->isRasterNotified = iTrue;
+            postCommand_App("text.glyphs.ready");
+        }
+    }
+    unlock_Mutex(d->rasterMutex);
+    return 0;
+}
+
+static void startRasterWorkers_Text_(iText *d) {
+    d->rasterMutex = new_Mutex();
+    init_Condition(&d->rasterAvailable);
+    init_Condition(&d->rasterIdle);
+    init_Array(&d->rasterQueue, sizeof(iRasterJob));
+    init_Array(&d->rasterDone, sizeof(iRasterJob));
+    d->numRasterBusy    = 0;
+    d->isRasterStopping = iFalse;
+    d->isRasterNotified = iFalse;
+    d->isAsyncRaster    = iFalse;
+    d->numRasterAsync   = 0;
+    /* Leave one core for the main thread. */
+    d->numRasterWorkers = iClamp(SDL_GetCPUCount() - 1, 1, maxRasterWorkers_Text_);
+    for (int i = 0; i < d->numRasterWorkers; i++) {
+        d->rasterWorkers[i] = new_Thread(rasterize_Text_);
+        setUserData_Thread(d->rasterWorkers[i], d);
+        start_Thread(d->rasterWorkers[i]);
+    }
+}
+
+static void stopRasterWorkers_Text_(iText *d) {
+    iGuardMutex(d->rasterMutex, {
+        d->isRasterStopping = iTrue;
+        signalAll_Condition(&d->rasterAvailable);
+    });
+    for (int i = 0; i < d->numRasterWorkers; i++) {
+        join_Thread(d->rasterWorkers[i]);
+        iReleasePtr(&d->rasterWorkers[i]);
+    }
+    d->numRasterWorkers = 0;
+    freeRasterJobs_(&d->rasterDone);
+    deinit_Array(&d->rasterDone);
+    deinit_Array(&d->rasterQueue);
+    deinit_Condition(&d->rasterIdle);
+    deinit_Condition(&d->rasterAvailable);
+    delete_Mutex(d->rasterMutex);
+    d->rasterMutex = NULL;
+}
+
+static void cancelRasterJobs_Text_(iText *d) {
+    /* The fonts are about to change. Jobs that haven't been started are dropped and we wait
+       until the workers are no longer using the font data. */
+    lock_Mutex(d->rasterMutex);
+    clear_Array(&d->rasterQueue);
+    while (d->numRasterBusy > 0) {
+        wait_Condition(&d->rasterIdle, d->rasterMutex);
+    }
+    freeRasterJobs_(&d->rasterDone);
+    unlock_Mutex(d->rasterMutex);
+    /* The dropped glyphs will be queued again when they are next drawn. */
+    lock_Mutex(d->glyphsMutex);
+    for (int i = 0; i < max_FontId; i++) {
+        iForEach(Hash, j, &d->fonts[i].glyphs) {
+            ((iGlyph *) j.value)->flags &= ~(pending0_GlyphFlag | pending1_GlyphFlag);
+        }
+    }
+    unlock_Mutex(d->glyphsMutex);
+}
+
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+static iHashKey diskGlyphKey_(uint32_t fontKey, uint32_t glyphIndex, int hoff) {
+    const uint32_t key = hash32_Data(fontKey, &glyphIndex, sizeof(glyphIndex));
+    return hash32_Data(key, &hoff, sizeof(hoff));
+}
+
+static const char *diskGlyphsPath_Text_(void) {
+    return concatPath_CStr(cstr_String(dataDir_App()), diskGlyphsFileName_Text_);
+}
+
+static iBool insertDiskGlyph_Text_(iText *d, iDiskGlyph *glyph) {
+    glyph->node.key = diskGlyphKey_(glyph->fontKey, glyph->glyphIndex, glyph->hoff);
+    if (value_Hash(&d->diskGlyphs, glyph->node.key)) {
+        free(glyph->bmp); /* already have it (or a colliding key) */
+        free(glyph);
+        return iFalse;
+    }
+    insert_Hash(&d->diskGlyphs, &glyph->node);
+    return iTrue;
+}
+
+static void loadDiskGlyphs_Text_(iText *d) {
+    d->isDiskGlyphsLoaded = iTrue;
+    iFile *f = newCStr_File(diskGlyphsPath_Text_());
+    if (open_File(f, readOnly_FileMode)) {
+        char magic[4];
+        readData_File(f, 4, magic);
+        if (!memcmp(magic, magicDiskGlyphs_Text_, 4) && readU32_File(f) == 1 /* version */) {
+            const uint32_t count = readU32_File(f);
+            for (uint32_t i = 0; i < count && !atEnd_File(f); i++) {
+                iDiskGlyph *glyph = calloc(1, sizeof(iDiskGlyph));
+                glyph->fontKey    = readU32_File(f);
+                glyph->glyphIndex = readU32_File(f);
+                glyph->hoff       = readU8_File(f);
+                glyph->size.x     = readU16_File(f);
+                glyph->size.y     = readU16_File(f);
+                glyph->offset.x   = read16_File(f);
+                glyph->offset.y   = read16_File(f);
+                glyph->advance    = readf_Stream(stream_File(f));
+                const size_t bmpSize = glyph->size.x * glyph->size.y;
+                if (glyph->hoff > 1 || glyph->size.x > 1024 || glyph->size.y > 1024) {
+                    free(glyph);
+                    break; /* corrupted */
+                }
+                if (bmpSize) {
+                    glyph->bmp = malloc(bmpSize);
+                    if (readData_File(f, bmpSize, glyph->bmp) != bmpSize) {
+                        free(glyph->bmp);
+                        free(glyph);
+                        break;
+                    }
+                }
+                insertDiskGlyph_Text_(d, glyph);
+            }
+        }
+    }
+    iRelease(f);
+}
+
+static void saveDiskGlyphs_Text_(iText *d) {
+    if (!d->isDiskGlyphsChanged) {
+        return;
+    }
+    iFile *f = newCStr_File(diskGlyphsPath_Text_());
+    if (open_File(f, writeOnly_FileMode)) {
+        writeData_File(f, magicDiskGlyphs_Text_, 4);
+        writeU32_File(f, 1); /* version */
+        writeU32_File(f, d->numDiskGlyphsUsed);
+        iConstForEach(Hash, i, &d->diskGlyphs) {
+            const iDiskGlyph *glyph = (const iDiskGlyph *) i.value;
+            if (!glyph->isUsed) {
+                continue;
+            }
+            writeU32_File(f, glyph->fontKey);
+            writeU32_File(f, glyph->glyphIndex);
+            writeU8_File(f, glyph->hoff);
+            writeU16_File(f, glyph->size.x);
+            writeU16_File(f, glyph->size.y);
+            write16_File(f, glyph->offset.x);
+            write16_File(f, glyph->offset.y);
+            writef_Stream(stream_File(f), glyph->advance);
+            writeData_File(f, glyph->bmp, glyph->size.x * glyph->size.y);
+        }
+    }
+    iRelease(f);
+    d->isDiskGlyphsChanged = iFalse;
+}
+
+static void deinitDiskGlyphs_Text_(iText *d) {
+    saveDiskGlyphs_Text_(d);
+    iForEach(Hash, i, &d->diskGlyphs) {
+        iDiskGlyph *glyph = (iDiskGlyph *) i.value;
+        remove_HashIterator(&i);
+        free(glyph->bmp);
+        free(glyph);
+    }
+    deinit_Hash(&d->diskGlyphs);
+}
+
+static const iDiskGlyph *diskGlyph_Text_(iText *d, const iFont *font, uint32_t glyphIndex,
+                                         int hoff) {
+    /* Only used in the main thread. */
+    if (!d->isDiskGlyphsLoaded) {
+        loadDiskGlyphs_Text_(d);
+    }
+    iDiskGlyph *glyph = (iDiskGlyph *) value_Hash(&d->diskGlyphs,
+                                                  diskGlyphKey_(font->cacheKey, glyphIndex, hoff));
+    if (glyph && glyph->fontKey == font->cacheKey && glyph->glyphIndex == glyphIndex &&
+        glyph->hoff == hoff) {
+        if (!glyph->isUsed) {
+            glyph->isUsed = iTrue;
+            d->numDiskGlyphsUsed++;
+        }
+        return glyph;
+    }
+    return NULL;
+}
+
+static void storeDiskGlyph_Text_(iText *d, const iFont *font, const iGlyph *glyph, int hoff,
+                                 const uint8_t *bmp) {
+    if (d->numDiskGlyphsUsed >= maxDiskGlyphs_Text_ ||
+        diskGlyph_Text_(d, font, glyph->glyphIndex, hoff)) {
+        return;
+    }
+    iDiskGlyph *disk = calloc(1, sizeof(iDiskGlyph));
+    disk->fontKey    = font->cacheKey;
+    disk->glyphIndex = glyph->glyphIndex;
+    disk->hoff       = hoff;
+    disk->isUsed     = iTrue;
+    disk->size       = glyph->rect[hoff].size;
+    disk->offset     = glyph->d[hoff];
+    disk->advance    = glyph->advance;
+    const size_t bmpSize = disk->size.x * disk->size.y;
+    if (bmpSize && bmp) {
+        disk->bmp = malloc(bmpSize);
+        memcpy(disk->bmp, bmp, bmpSize);
+    }
+    else {
+        disk->size = zero_I2();
+    }
+    if (insertDiskGlyph_Text_(d, disk)) {
+        d->numDiskGlyphsUsed++;
+        d->isDiskGlyphsChanged = iTrue;
+    }
+}
+#endif /* LAGRANGE_ENABLE_GLYPH_DISK_CACHE */
+
 void loadUserFonts_Text(void) {
+    if (text_.rasterMutex) {
+        cancelRasterJobs_Text_(&text_); /* workers may be using the old font */
+    }
     if (userFont_) {
         delete_Block(userFont_);
         userFont_ = NULL;
@@ -428,12 +849,25 @@ void loadUserFonts_Text(void) {
 
 void init_Text(SDL_Renderer *render) {
     iText *d = &text_;
+    startRasterWorkers_Text_(d);
     loadUserFonts_Text();
     d->contentFont     = nunito_TextFont;
     d->headingFont     = nunito_TextFont;
     d->contentFontSize = contentScale_Text_;
     d->ansiEscape      = new_RegExp("[[()]([0-9;AB]*)m", 0);
     d->render          = render;
+    d->mainThread      = SDL_ThreadID();
+    d->glyphsMutex     = new_Mutex();
+    d->fontsMutex      = new_Mutex();
+    d->numDrawCalls    = 0;
+    d->useCounter      = 0;
+    d->numEvictions    = 0;
+    d->numRasterized   = 0;
+#if defined (LAGRANGE_GLYPH_BATCHING)
+    init_Array(&d->batchVerts, sizeof(SDL_Vertex));
+    init_Array(&d->batchIndices, sizeof(int));
+    d->batchPage = 0;
+#endif
     /* A grayscale palette for rasterized glyphs. */ {
         SDL_Color colors[256];
         for (int i = 0; i < 256; ++i) {
@@ -442,21 +876,53 @@ void init_Text(SDL_Renderer *render) {
         d->grayscale = SDL_AllocPalette(256);
         SDL_SetPaletteColors(d->grayscale, colors, 0, 256);
     }
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+    init_Hash(&d->diskGlyphs);
+    d->isDiskGlyphsLoaded  = iFalse;
+    d->isDiskGlyphsChanged = iFalse;
+    d->numDiskGlyphsUsed   = 0;
+#endif
     initCache_Text_(d);
     initFonts_Text_(d);
 }
 
 void deinit_Text(void) {
     iText *d = &text_;
+    stopRasterWorkers_Text_(d);
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+    deinitDiskGlyphs_Text_(d);
+#endif
     SDL_FreePalette(d->grayscale);
     deinitFonts_Text_(d);
     deinitCache_Text_(d);
     d->render = NULL;
     iRelease(d->ansiEscape);
+    delete_Mutex(d->fontsMutex);
+    delete_Mutex(d->glyphsMutex);
+#if defined (LAGRANGE_GLYPH_BATCHING)
+    deinit_Array(&d->batchIndices);
+    deinit_Array(&d->batchVerts);
+#endif
+}
+
+size_t numDrawCalls_Text(void) {
+    return text_.numDrawCalls;
+}
+
+static iBool isMainThread_Text_(void) {
+    return SDL_ThreadID() == text_.mainThread;
+}
+
+void lockFonts_Text(void) {
+    lock_Mutex(text_.fontsMutex);
+}
+
+void unlockFonts_Text(void) {
+    unlock_Mutex(text_.fontsMutex);
 }
 
 void setOpacity_Text(float opacity) {
-    SDL_SetTextureAlphaMod(text_.cache, iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f);
+    setCacheAlpha_Text_(&text_, iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f);
 }
 
 void setContentFont_Text(enum iTextFont font) {
@@ -482,30 +948,75 @@ void setContentFontSize_Text(float fontSizeFactor) {
     }
 }
 
-static void resetCache_Text_(iText *d) {
-    deinitCache_Text_(d);
+static void flushGlyphs_Text_(iText *d);
+
+static void evictPage_Text_(iText *d, int index) {
+    /* Glyphs on the page are forgotten and will be cached again when needed. */
+#if defined (LAGRANGE_GLYPH_BATCHING)
+    if (index == d->batchPage) {
+        flushGlyphs_Text_(d); /* batched quads refer to the page's current contents */
+    }
+#endif
+    lock_Mutex(d->glyphsMutex);
     for (int i = 0; i < max_FontId; i++) {
-        clearGlyphs_Font_(&d->fonts[i]);
+        iForEach(Hash, j, &d->fonts[i].glyphs) {
+            iGlyph *glyph = (iGlyph *) j.value;
+            if (glyph->page == index) {
+                remove_HashIterator(&j);
+                delete_Glyph(glyph);
+            }
+        }
     }
-    initCache_Text_(d);
+    unlock_Mutex(d->glyphsMutex);
+    iCachePage *page = cachePage_Text_(d, index);
+    deinit_Array(&page->rows);
+    initPage_Text_(d, page);
+    d->numEvictions++;
+}
+
+static void reserveCacheSpace_Text_(iText *d) {
+    /* Makes sure the current page has room for a new glyph (two rows of the largest size).
+       A new page is added if possible; otherwise the least recently used page is reused. */
+    const iCachePage *page = cachePage_Text_(d, d->cachePage);
+    if (page->bottom <= d->cacheSize.y - 2 * maxGlyphHeight_Text_(d)) {
+        return;
+    }
+    if ((int) size_Array(&d->cachePages) < d->maxCachePages) {
+        addPage_Text_(d);
+        return;
+    }
+    int lru = -1;
+    iConstForEach(Array, i, &d->cachePages) {
+        const iCachePage *candidate = i.value;
+        if ((int) i.pos != d->cachePage &&
+            (lru < 0 || candidate->lastUsed < cachePage_Text_(d, lru)->lastUsed)) {
+            lru = i.pos;
+        }
+    }
+#if !defined (NDEBUG)
+    printf("[Text] glyph cache is full, evicting page %d\n", lru); fflush(stdout);
+#endif
+    evictPage_Text_(d, lru);
+    d->cachePage = lru;
 }
 
 void resetFonts_Text(void) {
     iText *d = &text_;
+    lockFonts_Text(); /* wait for background layout to finish */
+    cancelRasterJobs_Text_(d);
     deinitFonts_Text_(d);
     deinitCache_Text_(d);
     initCache_Text_(d);
     initFonts_Text_(d);
+    unlockFonts_Text();
 }
 
 iLocalDef iFont *font_Text_(enum iFontId id) {
     return &text_.fonts[id & mask_FontId];
 }
 
-static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, float xShift) {
-    int w, h;
-    uint8_t *bmp = stbtt_GetGlyphBitmapSubpixel(
-        &d->font, d->xScale, d->yScale, xShift, 0.0f, glyphIndex, &w, &h, 0, 0);
+static SDL_Surface *glyphSurface_Text_(uint8_t *bmp, int w, int h) {
+    /* The surface takes ownership of `bmp`. Free with freeGlyphSurface_(). */
     SDL_Surface *surface8 =
         SDL_CreateRGBSurfaceWithFormatFrom(bmp, w, h, 8, w, SDL_PIXELFORMAT_INDEX8);
     SDL_SetSurfaceBlendMode(surface8, SDL_BLENDMODE_NONE);
@@ -522,41 +1033,82 @@ static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, fl
 #endif
 }
 
-iLocalDef iCacheRow *cacheRow_Text_(iText *d, int height) {
-    return at_Array(&d->cacheRows, (height - 1) / d->cacheRowAllocStep);
+static void freeGlyphSurface_(SDL_Surface *surface) {
+    if (surface->flags & SDL_PREALLOC) {
+        free(surface->pixels);
+    }
+    SDL_FreeSurface(surface);
+}
+
+static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, const iGlyph *glyph, int hoff) {
+    int w, h;
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+    const iDiskGlyph *disk = diskGlyph_Text_(&text_, d, glyph->glyphIndex, hoff);
+    if (disk && isEqual_I2(disk->size, glyph->rect[hoff].size)) {
+        w = disk->size.x;
+        h = disk->size.y;
+        uint8_t *bmp = NULL;
+        if (w * h) {
+            bmp = malloc(w * h);
+            memcpy(bmp, disk->bmp, w * h);
+        }
+        return glyphSurface_Text_(bmp, w, h);
+    }
+#endif
+    uint8_t *bmp = stbtt_GetGlyphBitmapSubpixel(
+        &d->font, d->xScale, d->yScale, hoff * 0.5f, 0.0f, glyph->glyphIndex, &w, &h, 0, 0);
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+    storeDiskGlyph_Text_(&text_, d, glyph, hoff, bmp);
+#endif
+    return glyphSurface_Text_(bmp, w, h);
+}
+
+iLocalDef iCacheRow *cacheRow_Text_(iText *d, iCachePage *page, int height) {
+    return at_Array(&page->rows, (height - 1) / d->cacheRowAllocStep);
 }
 
 static iInt2 assignCachePos_Text_(iText *d, iInt2 size) {
-    iCacheRow *cur = cacheRow_Text_(d, size.y);
+    iCachePage *page = cachePage_Text_(d, d->cachePage);
+    iCacheRow  *cur  = cacheRow_Text_(d, page, size.y);
     if (cur->height == 0) {
         /* Begin a new row height. */
         cur->height = (1 + (size.y - 1) / d->cacheRowAllocStep) * d->cacheRowAllocStep;
-        cur->pos.y = d->cacheBottom;
-        d->cacheBottom = cur->pos.y + cur->height;
+        cur->pos.y = page->bottom;
+        page->bottom = cur->pos.y + cur->height;
     }
     iAssert(cur->height >= size.y);
-    /* TODO: Automatically enlarge the cache if running out of space?
-       Maybe make it paged, but beware of texture swapping too often inside a text string. */
     if (cur->pos.x + size.x > d->cacheSize.x) {
         /* Does not fit on this row, advance to a new location in the cache. */
-        cur->pos.y = d->cacheBottom;
+        cur->pos.y = page->bottom;
         cur->pos.x = 0;
-        d->cacheBottom += cur->height;
-        iAssert(d->cacheBottom <= d->cacheSize.y);
+        page->bottom += cur->height;
+        iAssert(page->bottom <= d->cacheSize.y);
     }
     const iInt2 assigned = cur->pos;
     cur->pos.x += size.x;
+    page->lastUsed = d->useCounter;
     return assigned;
 }
 
-static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
+static void measure_Font_(iFont *d, iGlyph *glyph, int hoff) {
     iRect *glRect = &glyph->rect[hoff];
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+    if (isMainThread_Text_()) {
+        const iDiskGlyph *disk = diskGlyph_Text_(&text_, d, glyph->glyphIndex, hoff);
+        if (disk) {
+            glRect->size   = disk->size;
+            glyph->d[hoff] = disk->offset;
+            if (hoff == 0) {
+                glyph->advance = disk->advance;
+            }
+            return;
+        }
+    }
+#endif
     int    x0, y0, x1, y1;
     stbtt_GetGlyphBitmapBoxSubpixel(
         &d->font, glyph->glyphIndex, d->xScale, d->yScale, hoff * 0.5f, 0.0f, &x0, &y0, &x1, &y1);
-    glRect->size = init_I2(x1 - x0, y1 - y0);
-    /* Determine placement in the glyph cache texture, advancing in rows. */
-    glRect->pos    = assignCachePos_Text_(&text_, glRect->size);
+    glRect->size   = init_I2(x1 - x0, y1 - y0);
     glyph->d[hoff] = init_I2(x0, y0);
     glyph->d[hoff].y += d->vertOffset;
     if (hoff == 0) { /* hoff==1 uses same metrics as `glyph` */
@@ -567,6 +1119,13 @@ static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
     }
 }
 
+static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
+    measure_Font_(d, glyph, hoff);
+    /* Determine placement in the glyph cache texture, advancing in rows. */
+    glyph->page = text_.cachePage;
+    glyph->rect[hoff].pos = assignCachePos_Text_(&text_, glyph->rect[hoff].size);
+}
+
 iLocalDef iFont *characterFont_Font_(iFont *d, iChar ch, uint32_t *glyphIndex) {
     if (isVariationSelector_Char(ch)) {
         return d;
@@ -663,13 +1222,8 @@ static iGlyph *glyph_Font_(iFont *d, iChar ch) {
         glyph = node;
     }
     else {
-        /* If the cache is running out of space, clear it and we'll recache what's needed currently. */
-        if (text_.cacheBottom > text_.cacheSize.y - maxGlyphHeight_Text_(&text_)) {
-#if !defined (NDEBUG)
-            printf("[Text] glyph cache is full, clearing!\n"); fflush(stdout);
-#endif
-            resetCache_Text_(&text_);
-        }
+        /* Both offsets of the glyph are placed on the same page. */
+        reserveCacheSpace_Text_(&text_);
         glyph             = new_Glyph(ch);
         glyph->glyphIndex = glyphIndex;
         glyph->font       = font;
@@ -677,11 +1231,40 @@ static iGlyph *glyph_Font_(iFont *d, iChar ch) {
            and updates the glyph metrics. */
         allocate_Font_(font, glyph, 0);
         allocate_Font_(font, glyph, 1);
+        cachePage_Text_(&text_, glyph->page)->numGlyphs++;
+        lock_Mutex(text_.glyphsMutex);
         insert_Hash(&font->glyphs, &glyph->node);
+        unlock_Mutex(text_.glyphsMutex);
     }
     return glyph;
 }
 
+static const iGlyph *glyphMetrics_Font_(iFont *d, iChar ch, iGlyph *buf) {
+    /* Only the main thread may allocate glyphs in the cache. Background threads get a copy
+       of the glyph's metrics in `buf`, computed on the fly if the glyph isn't cached yet. */
+    if (isMainThread_Text_()) {
+        return glyph_Font_(d, ch);
+    }
+    uint32_t glyphIndex = 0;
+    iFont *  font       = characterFont_Font_(d, ch, &glyphIndex);
+    iBool    isCached   = iFalse;
+    lock_Mutex(text_.glyphsMutex);
+    const iGlyph *cached = (const iGlyph *) value_Hash(&font->glyphs, ch);
+    if (cached) {
+        *buf     = *cached;
+        isCached = iTrue;
+    }
+    unlock_Mutex(text_.glyphsMutex);
+    if (!isCached) {
+        init_Glyph(buf, ch);
+        buf->glyphIndex = glyphIndex;
+        buf->font       = font;
+        measure_Font_(font, buf, 0);
+        measure_Font_(font, buf, 1);
+    }
+    return buf;
+}
+
 static iChar nextChar_(const char **chPos, const char *end) {
     if (*chPos == end) {
         return 0;
@@ -723,11 +1306,11 @@ void cacheTextGlyphs_Font_(iFont *d, const iRangecc text) {
                 isFitzpatrickType_Char(ch)) {
                 continue;
             }
-            const int lastCacheBottom = text_.cacheBottom;
+            const size_t lastEvictions = text_.numEvictions;
             iGlyph *glyph = glyph_Font_(d, ch);
-            if (text_.cacheBottom < lastCacheBottom) {
-                /* The cache was reset due to running out of space. We need to restart from
-                   the beginning! */
+            if (text_.numEvictions != lastEvictions) {
+                /* A cache page was evicted due to running out of space. Glyphs already
+                   processed may have been on it, so we need to restart from the beginning! */
                 chPos = text.start;
                 bufX = 0;
                 if (rasters) {
@@ -747,9 +1330,9 @@ void cacheTextGlyphs_Font_(iFont *d, const iRangecc text) {
                 }
                 SDL_Surface *surfaces[2] = {
                     !isRasterized_Glyph_(glyph, 0) ?
-                            rasterizeGlyph_Font_(glyph->font, glyph->glyphIndex, 0) : NULL,
+                            rasterizeGlyph_Font_(glyph->font, glyph, 0) : NULL,
                     !isRasterized_Glyph_(glyph, 1) ?
-                            rasterizeGlyph_Font_(glyph->font, glyph->glyphIndex, 0.5f) : NULL
+                            rasterizeGlyph_Font_(glyph->font, glyph, 1) : NULL
                 };
                 iBool outOfSpace = iFalse;
                 iForIndices(i, surfaces) {
@@ -773,10 +1356,7 @@ void cacheTextGlyphs_Font_(iFont *d, const iRangecc text) {
                 }
                 iForIndices(i, surfaces) {
                     if (surfaces[i]) {
-                        if (surfaces[i]->flags & SDL_PREALLOC) {
-                            free(surfaces[i]->pixels);
-                        }
-                        SDL_FreeSurface(surfaces[i]);
+                        freeGlyphSurface_(surfaces[i]);
                     }
                 }
                 if (outOfSpace) {
@@ -792,18 +1372,22 @@ void cacheTextGlyphs_Font_(iFont *d, const iRangecc text) {
             if (!isTargetChanged) {
                 isTargetChanged = iTrue;
                 oldTarget = SDL_GetRenderTarget(text_.render);
-                SDL_SetRenderTarget(text_.render, text_.cache);
             }
 //            printf("copying %zu rasters from %p\n", size_Array(rasters), bufTex); fflush(stdout);
             iConstForEach(Array, i, rasters) {
                 const iRasterGlyph *rg = i.value;
 //                iAssert(isEqual_I2(rg->rect.size, rg->glyph->rect[rg->hoff].size));
+                SDL_Texture *pageTex = cachePage_Text_(&text_, rg->glyph->page)->texture;
+                if (SDL_GetRenderTarget(text_.render) != pageTex) {
+                    SDL_SetRenderTarget(text_.render, pageTex);
+                }
                 const iRect *glRect = &rg->glyph->rect[rg->hoff];
                 SDL_RenderCopy(text_.render,
                                bufTex,
                                (const SDL_Rect *) &rg->rect,
                                (const SDL_Rect *) glRect);
                 setRasterized_Glyph_(rg->glyph, rg->hoff);
+                text_.numRasterized++;
 //                printf(" - %u\n", rg->glyph->glyphIndex);
             }
             SDL_DestroyTexture(bufTex);
@@ -826,6 +1410,160 @@ void cacheTextGlyphs_Font_(iFont *d, const iRangecc text) {
     }
 }
 
+static void queueTextGlyphs_Font_(iFont *d, const iRangecc text) {
+    /* Space is reserved in the cache for the missing glyphs right away, but the rasterizing
+       is done by the worker threads. uploadGlyphs_Text() copies the results to the cache. */
+    iArray jobs, ready;
+    init_Array(&jobs, sizeof(iRasterJob));
+    init_Array(&ready, sizeof(iRasterJob)); /* no need to rasterize */
+    for (const char *chPos = text.start; chPos < text.end; ) {
+        const iChar ch = nextChar_(&chPos, text.end);
+        if (ch == 0 || isSpace_Char(ch) || isDefaultIgnorable_Char(ch) ||
+            isFitzpatrickType_Char(ch)) {
+            continue;
+        }
+        /* If a page gets evicted here, the jobs of the evicted glyphs are simply ignored
+           when uploading. */
+        iGlyph *glyph = glyph_Font_(d, ch);
+        for (int hoff = 0; hoff < 2; hoff++) {
+            if (!isRasterized_Glyph_(glyph, hoff) && !isPending_Glyph_(glyph, hoff)) {
+                iRasterJob job = { .font       = glyph->font,
+                                   .ch         = codepoint_Glyph_(glyph),
+                                   .hoff       = hoff,
+                                   .glyphIndex = glyph->glyphIndex };
+                setFlags_Glyph_(glyph, pending0_GlyphFlag << hoff, 0);
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+                const iDiskGlyph *disk = diskGlyph_Text_(&text_, glyph->font, glyph->glyphIndex, hoff);
+                if (disk && disk->bmp && isEqual_I2(disk->size, glyph->rect[hoff].size)) {
+                    job.size = disk->size;
+                    job.bmp  = malloc(job.size.x * job.size.y);
+                    memcpy(job.bmp, disk->bmp, job.size.x * job.size.y);
+                    pushBack_Array(&ready, &job);
+                    continue;
+                }
+#endif
+                pushBack_Array(&jobs, &job);
+            }
+        }
+    }
+    if (!isEmpty_Array(&jobs) || !isEmpty_Array(&ready)) {
+        iGuardMutex(text_.rasterMutex, {
+            pushBackN_Array(&text_.rasterQueue, constData_Array(&jobs), size_Array(&jobs));
+            signalAll_Condition(&text_.rasterAvailable);
+            if (!isEmpty_Array(&ready)) {
+                pushBackN_Array(&text_.rasterDone, constData_Array(&ready), size_Array(&ready));
+                if (!text_.isRasterNotified) {
+                    text_.isRasterNotified = iTrue;
+                    postCommand_App("text.glyphs.ready");
+                }
+            }
+        });
+    }
+    deinit_Array(&ready);
+    deinit_Array(&jobs);
+}
+
+static iGlyph *pendingGlyph_RasterJob_(const iRasterJob *d) {
+    /* The glyph may have been evicted, or rasterized on the main thread meanwhile. */
+    iGlyph *glyph = value_Hash(&d->font->glyphs, d->ch);
+    if (glyph && !isRasterized_Glyph_(glyph, d->hoff) &&
+        isEqual_I2(glyph->rect[d->hoff].size, d->size)) {
+        return glyph;
+    }
+    return NULL;
+}
+
+void uploadGlyphs_Text(void) {
+    iText *d = &text_;
+    iArray jobs;
+    init_Array(&jobs, sizeof(iRasterJob));
+    iGuardMutex(d->rasterMutex, {
+        setCopy_Array(&jobs, &d->rasterDone);
+        clear_Array(&d->rasterDone);
+        d->isRasterNotified = iFalse;
+    });
+    /* Discard the results that are no longer needed. */
+    iForEach(Array, i, &jobs) {
+        iRasterJob *job   = i.value;
+        iGlyph *    glyph = pendingGlyph_RasterJob_(job);
+        if (!glyph || !job->bmp) {
+            if (glyph) {
+                setRasterized_Glyph_(glyph, job->hoff); /* nothing to draw */
+            }
+            else {
+                /* If the glyph was reallocated with a different size, it must be queued
+                   again when next drawn. */
+                iGlyph *stale = value_Hash(&job->font->glyphs, job->ch);
+                if (stale && !isRasterized_Glyph_(stale, job->hoff)) {
+                    setFlags_Glyph_(stale, 0, pending0_GlyphFlag << job->hoff);
+                }
+            }
+            stbtt_FreeBitmap(job->bmp, NULL);
+            remove_ArrayIterator(&i);
+        }
+    }
+    SDL_Texture *oldTarget = SDL_GetRenderTarget(d->render);
+    /* The rasters are combined into strips so only a few buffer textures are needed. */
+    const int maxStripWidth = 1024;
+    for (size_t pos = 0; pos < size_Array(&jobs); ) {
+        size_t end = pos;
+        iInt2  stripSize = zero_I2();
+        for (; end < size_Array(&jobs); end++) {
+            const iRasterJob *job = constAt_Array(&jobs, end);
+            if (end > pos && stripSize.x + job->size.x > maxStripWidth) {
+                break;
+            }
+            stripSize.x += job->size.x;
+            stripSize.y = iMax(stripSize.y, job->size.y);
+        }
+        SDL_Surface *buf = SDL_CreateRGBSurfaceWithFormat(
+            0, stripSize.x, stripSize.y, LAGRANGE_RASTER_DEPTH, LAGRANGE_RASTER_FORMAT);
+        SDL_SetSurfaceBlendMode(buf, SDL_BLENDMODE_NONE);
+        SDL_SetSurfacePalette(buf, d->grayscale);
+        int x = 0;
+        for (size_t j = pos; j < end; j++) {
+            const iRasterJob *job  = constAt_Array(&jobs, j);
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+            const iGlyph *glyph = pendingGlyph_RasterJob_(job);
+            if (glyph) {
+                storeDiskGlyph_Text_(d, job->font, glyph, job->hoff, job->bmp);
+            }
+#endif
+            SDL_Surface *     surf = glyphSurface_Text_(job->bmp, job->size.x, job->size.y);
+            SDL_BlitSurface(surf, NULL, buf, &(SDL_Rect){ x, 0, job->size.x, job->size.y });
+            freeGlyphSurface_(surf);
+            x += job->size.x;
+        }
+        SDL_Texture *bufTex = SDL_CreateTextureFromSurface(d->render, buf);
+        SDL_SetTextureBlendMode(bufTex, SDL_BLENDMODE_NONE);
+        x = 0;
+        for (size_t j = pos; j < end; j++) {
+            const iRasterJob *job   = constAt_Array(&jobs, j);
+            iGlyph *          glyph = pendingGlyph_RasterJob_(job);
+            if (glyph) { /* may have been a duplicate job */
+                SDL_SetRenderTarget(d->render, cachePage_Text_(d, glyph->page)->texture);
+                SDL_RenderCopy(d->render,
+                               bufTex,
+                               &(SDL_Rect){ x, 0, job->size.x, job->size.y },
+                               (const SDL_Rect *) &glyph->rect[job->hoff]);
+                setRasterized_Glyph_(glyph, job->hoff);
+                d->numRasterized++;
+                d->numRasterAsync++;
+            }
+            x += job->size.x;
+        }
+        SDL_DestroyTexture(bufTex);
+        SDL_FreeSurface(buf);
+        pos = end;
+    }
+    SDL_SetRenderTarget(d->render, oldTarget);
+    deinit_Array(&jobs);
+}
+
+void setAsyncGlyphs_Text(iBool enable) {
+    text_.isAsyncRaster = enable;
+}
+
 enum iRunMode {
     measure_RunMode                 = 0,
     draw_RunMode                    = 1,
@@ -882,6 +1620,61 @@ iLocalDef iBool isMeasuring_(enum iRunMode mode) {
     return (mode & modeMask_RunMode) == measure_RunMode;
 }
 
+static void flushGlyphs_Text_(iText *d) {
+#if defined (LAGRANGE_GLYPH_BATCHING)
+    if (isEmpty_Array(&d->batchVerts)) {
+        return;
+    }
+    /* Vertex colors already include the color and opacity modulation. */
+    SDL_Texture *texture = cachePage_Text_(d, d->batchPage)->texture;
+    SDL_SetTextureColorMod(texture, 255, 255, 255);
+    SDL_SetTextureAlphaMod(texture, 255);
+    SDL_RenderGeometry(d->render,
+                       texture,
+                       constData_Array(&d->batchVerts),
+                       (int) size_Array(&d->batchVerts),
+                       constData_Array(&d->batchIndices),
+                       (int) size_Array(&d->batchIndices));
+    SDL_SetTextureColorMod(texture, d->cacheColor.r, d->cacheColor.g, d->cacheColor.b);
+    SDL_SetTextureAlphaMod(texture, d->cacheColor.a);
+    clear_Array(&d->batchVerts);
+    clear_Array(&d->batchIndices);
+    d->numDrawCalls++;
+#else
+    iUnused(d);
+#endif
+}
+
+static void drawGlyph_Text_(iText *d, int page, const SDL_Rect *src, const SDL_Rect *dst,
+                            SDL_Color color) {
+    cachePage_Text_(d, page)->lastUsed = d->useCounter;
+#if defined (LAGRANGE_GLYPH_BATCHING)
+    /* Glyphs are collected into a batch that is drawn with a single call. */
+    if (page != d->batchPage) {
+        flushGlyphs_Text_(d);
+        d->batchPage = page;
+    }
+    const float u0   = (float) src->x / d->cacheSize.x;
+    const float v0   = (float) src->y / d->cacheSize.y;
+    const float u1   = (float) (src->x + src->w) / d->cacheSize.x;
+    const float v1   = (float) (src->y + src->h) / d->cacheSize.y;
+    const int   base = (int) size_Array(&d->batchVerts);
+    const SDL_Vertex verts[4] = {
+        { { dst->x, dst->y }, color, { u0, v0 } },
+        { { dst->x + dst->w, dst->y }, color, { u1, v0 } },
+        { { dst->x + dst->w, dst->y + dst->h }, color, { u1, v1 } },
+        { { dst->x, dst->y + dst->h }, color, { u0, v1 } },
+    };
+    const int indices[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+    pushBackN_Array(&d->batchVerts, verts, 4);
+    pushBackN_Array(&d->batchIndices, indices, 6);
+#else
+    iUnused(color);
+    SDL_RenderCopy(d->render, cachePage_Text_(d, page)->texture, src, dst);
+    d->numDrawCalls++;
+#endif
+}
+
 iDeclareType(RunArgs)
 
 struct Impl_RunArgs {
@@ -907,7 +1700,9 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
     float       xposExtend  = orig.x; /* allows wide glyphs to use more space; restored by whitespace */
     const enum iRunMode mode        = args->mode;
     const char *        lastWordEnd = args->text.start;
+    iGlyph              glyphBuf[2]; /* metrics of uncached glyphs (background measuring) */
     iAssert(args->xposLimit == 0 || isMeasuring_(mode));
+    iAssert(isMeasuring_(mode) || isMainThread_Text_());
     iAssert(args->text.end >= args->text.start);
     if (args->continueFrom_out) {
         *args->continueFrom_out = args->text.end;
@@ -915,12 +1710,17 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
     iChar prevCh = 0;
     const iBool isMonospaced = d->isMonospaced && !(mode & alwaysVariableWidthFlag_RunMode);
     if (isMonospaced) {
-        monoAdvance = glyph_Font_(d, 'M')->advance;
+        monoAdvance = glyphMetrics_Font_(d, 'M', &glyphBuf[0])->advance;
     }
     if (args->mode & fillBackground_RunMode) {
         const iColor initial = get_Color(args->color);
         SDL_SetRenderDrawColor(text_.render, initial.r, initial.g, initial.b, 0);
     }
+    SDL_Color glyphColor = { 255, 255, 255, 255 }; /* color escapes change this */
+    if (mode & draw_RunMode) {
+        glyphColor = text_.cacheColor;
+        text_.useCounter++;
+    }
     /* Text rendering is not very straightforward! Let's dive in... */
     for (const char *chPos = args->text.start; chPos != args->text.end; ) {
         iAssert(chPos < args->text.end);
@@ -934,7 +1734,8 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                     /* Change the color. */
                     const iColor clr =
                         ansiForeground_Color(capturedRange_RegExpMatch(&m, 1), tmParagraph_ColorId);
-                    SDL_SetTextureColorMod(text_.cache, clr.r, clr.g, clr.b);
+                    setCacheColor_Text_(&text_, clr);
+                    glyphColor = (SDL_Color){ clr.r, clr.g, clr.b, glyphColor.a };
                     if (args->mode & fillBackground_RunMode) {
                         SDL_SetRenderDrawColor(text_.render, clr.r, clr.g, clr.b, 0);
                     }
@@ -963,8 +1764,12 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                     if (args->xposLimit > 0) {
                         const char *postHyphen = chPos;
                         iChar       nextCh     = nextChar_(&postHyphen, args->text.end);
-                        if ((int) xpos + glyph_Font_(d, ch)->rect[0].size.x +
-                            glyph_Font_(d, nextCh)->rect[0].size.x > args->xposLimit) {
+                        /* Caching the second glyph may evict the first one. */
+                        const int hyphenWidth =
+                            glyphMetrics_Font_(d, ch, &glyphBuf[0])->rect[0].size.x;
+                        const int nextWidth =
+                            glyphMetrics_Font_(d, nextCh, &glyphBuf[1])->rect[0].size.x;
+                        if ((int) xpos + hyphenWidth + nextWidth > args->xposLimit) {
                             /* Wraps after hyphen, should show it. */
                         }
                         else continue;
@@ -1022,7 +1827,8 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                 }
                 if (mode & draw_RunMode && ~mode & permanentColorFlag_RunMode) {
                     const iColor clr = get_Color(colorNum);
-                    SDL_SetTextureColorMod(text_.cache, clr.r, clr.g, clr.b);
+                    setCacheColor_Text_(&text_, clr);
+                    glyphColor = (SDL_Color){ clr.r, clr.g, clr.b, glyphColor.a };
                     if (args->mode & fillBackground_RunMode) {
                         SDL_SetRenderDrawColor(text_.render, clr.r, clr.g, clr.b, 0);
                     }
@@ -1034,14 +1840,22 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                 continue;
             }
         }
-        const iGlyph *glyph = glyph_Font_(d, ch);
+        const iGlyph *glyph = glyphMetrics_Font_(d, ch, &glyphBuf[0]);
         int x1 = iMax(xpos, xposExtend);
         /* Which half of the pixel the glyph falls on? */
         const int hoff = enableHalfPixelGlyphs_Text ? (xpos - x1 > 0.5f ? 1 : 0) : 0;
-        if (mode & draw_RunMode && ch != 0x20 && ch != 0 && !isRasterized_Glyph_(glyph, hoff)) {
+        if (mode & draw_RunMode && ch != 0x20 && ch != 0 && !isRasterized_Glyph_(glyph, hoff) &&
+            !(text_.isAsyncRaster && isPending_Glyph_(glyph, hoff))) {
             /* Need to pause here and make sure all glyphs have been cached in the text. */
 //            printf("[Text] missing from cache: %lc (%x)\n", (int) ch, ch);
-            cacheTextGlyphs_Font_(d, args->text);
+            flushGlyphs_Text_(&text_); /* the cache may be reset */
+            if (text_.isAsyncRaster) {
+                /* Don't wait for the glyphs; they'll be drawn when the text is redrawn. */
+                queueTextGlyphs_Font_(d, args->text);
+            }
+            else {
+                cacheTextGlyphs_Font_(d, args->text);
+            }
             glyph = glyph_Font_(d, ch); /* cache may have been reset */
         }
         int x2 = x1 + glyph->rect[hoff].size.x;
@@ -1088,7 +1902,8 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
         const iBool useMonoAdvance =
             monoAdvance > 0 && !isJapanese_FontId(fontId_Text_(glyph->font));
         const float advance = (useMonoAdvance && glyph->advance > 0 ? monoAdvance : glyph->advance);
-        if (!isMeasuring_(mode) && ch != 0x20 /* don't bother rendering spaces */) {
+        if (!isMeasuring_(mode) && ch != 0x20 /* don't bother rendering spaces */ &&
+            isRasterized_Glyph_(glyph, hoff) /* otherwise left blank as a placeholder */) {
             if (useMonoAdvance && dst.w > advance && glyph->font != d && !isEmoji) {
                 /* Glyphs from a different font may need recentering to look better. */
                 dst.x -= (dst.w - advance) / 2;
@@ -1112,9 +1927,10 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
             if (args->mode & fillBackground_RunMode) {
                 /* Alpha blending looks much better if the RGB components don't change in
                    the partially transparent pixels. */
+                flushGlyphs_Text_(&text_); /* keep the drawing order */
                 SDL_RenderFillRect(text_.render, &dst);
             }
-            SDL_RenderCopy(text_.render, text_.cache, &src, &dst);
+            drawGlyph_Text_(&text_, glyph->page, &src, &dst, glyphColor);
         }
         xpos += advance;
         if (!isSpace_Char(ch)) {
@@ -1150,6 +1966,9 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
             break;
         }
     }
+    if (mode & draw_RunMode) {
+        flushGlyphs_Text_(&text_);
+    }
     if (args->runAdvance_out) {
         *args->runAdvance_out = xposMax - orig.x;
     }
@@ -1181,7 +2000,12 @@ iInt2 measure_Text(int fontId, const char *text) {
 }
 
 void cache_Text(int fontId, iRangecc text) {
-    cacheTextGlyphs_Font_(font_Text_(fontId), text);
+    if (text_.isAsyncRaster) {
+        queueTextGlyphs_Font_(font_Text_(fontId), text);
+    }
+    else {
+        cacheTextGlyphs_Font_(font_Text_(fontId), text);
+    }
 }
 
 static int runFlagsFromId_(enum iFontId fontId) {
@@ -1250,7 +2074,7 @@ static void drawBoundedN_Text_(int fontId, iInt2 pos, int xposBound, int color,
     iText *d    = &text_;
     iFont *font = font_Text_(fontId);
     const iColor clr = get_Color(color & mask_ColorId);
-    SDL_SetTextureColorMod(d->cache, clr.r, clr.g, clr.b);
+    setCacheColor_Text_(d, clr);
     run_Font_(font,
               &(iRunArgs){ .mode = draw_RunMode |
                                    (color & permanent_ColorId ? permanentColorFlag_RunMode : 0) |
@@ -1363,7 +2187,31 @@ void drawCenteredRange_Text(int fontId, iRect rect, iBool alignVisual, int color
 }
 
 SDL_Texture *glyphCache_Text(void) {
-    return text_.cache;
+    return cachePage_Text_(&text_, 0)->texture;
+}
+
+const iString *debugInfo_Text(void) {
+    iText   *d   = &text_;
+    iString *msg = collectNew_String();
+    const size_t numPages = size_Array(&d->cachePages);
+    appendFormat_String(msg, "* Glyph cache pages: %zu (max %d), %dx%d each\n",
+                        numPages, d->maxCachePages, d->cacheSize.x, d->cacheSize.y);
+    iConstForEach(Array, i, &d->cachePages) {
+        const iCachePage *page = i.value;
+        appendFormat_String(msg, "  * Page %zu: %d%% occupied, %zu glyphs%s\n",
+                            i.pos,
+                            100 * page->bottom / d->cacheSize.y,
+                            page->numGlyphs,
+                            (int) i.pos == d->cachePage ? " (current)" : "");
+    }
+    appendFormat_String(msg, "* Glyph cache evictions: %zu\n", d->numEvictions);
+    appendFormat_String(msg, "* Glyphs rasterized: %zu (%zu by %d background workers)\n",
+                        d->numRasterized, d->numRasterAsync, d->numRasterWorkers);
+#if defined (LAGRANGE_ENABLE_GLYPH_DISK_CACHE)
+    appendFormat_String(msg, "* Glyphs from the disk cache: %zu in use, %zu total\n",
+                        d->numDiskGlyphsUsed, size_Hash(&d->diskGlyphs));
+#endif
+    return msg;
 }
 
 static void freeBitmap_(void *ptr) {
@@ -1507,7 +2355,7 @@ static void initWrap_TextBuf_(iTextBuf *d, int font, int color, int maxWidth, iB
         SDL_SetRenderDrawBlendMode(render, SDL_BLENDMODE_NONE);
         SDL_SetRenderDrawColor(render, 255, 255, 255, 0);
         SDL_RenderClear(render);
-        SDL_SetTextureBlendMode(text_.cache, SDL_BLENDMODE_NONE); /* blended when TextBuf is drawn */
+        setCacheBlendMode_Text_(&text_, SDL_BLENDMODE_NONE); /* blended when TextBuf is drawn */
         const int fg    = color | fillBackground_ColorId;
         iRangecc  range = range_CStr(text);
         if (maxWidth == 0) {
@@ -1526,7 +2374,7 @@ static void initWrap_TextBuf_(iTextBuf *d, int font, int color, int maxWidth, iB
                 pos.y += lineHeight_Text(font);
             }
         }
-        SDL_SetTextureBlendMode(text_.cache, SDL_BLENDMODE_BLEND);
+        setCacheBlendMode_Text_(&text_, SDL_BLENDMODE_BLEND);
         SDL_SetRenderTarget(render, oldTarget);
         SDL_SetTextureBlendMode(d->texture, SDL_BLENDMODE_BLEND);
     }
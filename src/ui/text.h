@@ -136,6 +136,10 @@ void    setHeadingFont_Text     (enum iTextFont font);
 void    setContentFontSize_Text (float fontSizeFactor); /* affects all except `default*` fonts */
 void    resetFonts_Text         (void);
 
+/* Measuring is allowed in background threads while the fonts are locked. */
+void    lockFonts_Text          (void);
+void    unlockFonts_Text        (void);
+
 int     lineHeight_Text         (int fontId);
 iInt2   measure_Text            (int fontId, const char *text);
 iInt2   measureRange_Text       (int fontId, iRangecc text);
@@ -158,6 +162,12 @@ void    setOpacity_Text     (float opacity);
 
 void    cache_Text          (int fontId, iRangecc text); /* pre-render glyphs */
 
+/* With async glyphs, missing glyphs are rasterized in background threads and left out of the
+   drawn text. "text.glyphs.ready" is posted when some of them are done; after uploading them,
+   the text should be redrawn. */
+void    setAsyncGlyphs_Text (iBool enable);
+void    uploadGlyphs_Text   (void); /* copies rasterized glyphs to the cache */
+
 void    draw_Text               (int fontId, iInt2 pos, int color, const char *text, ...);
 void    drawAlign_Text          (int fontId, iInt2 pos, int color, enum iAlignment align, const char *text, ...);
 void    drawCentered_Text       (int fontId, iRect rect, iBool alignVisual, int color, const char *text, ...);
@@ -169,6 +179,8 @@ void    drawBoundRange_Text     (int fontId, iInt2 pos, int boundWidth, int colo
 int     drawWrapRange_Text      (int fontId, iInt2 pos, int maxWidth, int color, iRangecc text); /* returns new Y */
 
 SDL_Texture *   glyphCache_Text     (void);
+size_t          numDrawCalls_Text   (void); /* total number of glyph draw calls */
+const iString * debugInfo_Text      (void); /* glyph cache statistics */
 
 enum iTextBlockMode { quadrants_TextBlockMode, shading_TextBlockMode };
 
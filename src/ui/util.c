@@ -1921,6 +1921,7 @@ static iBool handleBookmarkCreationCommands_SidebarWidget_(iWidget *editor, cons
             if (isSelected_Widget(findChild_Widget(editor, "bmed.tag.linksplit"))) {
                 addTag_Bookmark(bm, linkSplit_BookmarkTag);
             }
+            reindex_Bookmarks(bookmarks_App());
             postCommand_App("bookmarks.changed");
         }
         setupSheetTransition_Mobile(editor, iFalse);
@@ -1985,6 +1986,7 @@ static iBool handleFeedSettingCommands_(iWidget *dlg, const char *cmd) {
             if (bm) {
                 set_String(&bm->title, feedTitle);
                 set_String(&bm->tags, tags);
+                reindex_Bookmarks(bookmarks_App());
             }
         }
         postCommand_App("bookmarks.changed");
@@ -485,6 +485,8 @@ void init_Window(iWindow *d, iRect rect) {
 #endif
     d->presentTime = 0.0;
     d->frameTime = SDL_GetTicks();
+    d->frameDrawTime = 0;
+    d->frameTextDrawCalls = 0;
     d->loadAnimTimer = 0;
     init_Text(d->render);
     SDL_GetRendererOutputSize(d->render, &d->size.x, &d->size.y);
@@ -1045,6 +1047,7 @@ void draw_Window(iWindow *d) {
     }
     /* Draw widgets. */
     d->frameTime = SDL_GetTicks();
+    const size_t startDrawCalls = numDrawCalls_Text();
     if (isExposed_Window(d)) {
         d->isInvalidated = iFalse;
         iForIndices(i, d->roots) {
@@ -1101,6 +1104,8 @@ void draw_Window(iWindow *d) {
         SDL_RenderCopy(d->render, glyphCache_Text(), NULL, &rect);
     }
 #endif
+    d->frameDrawTime      = SDL_GetTicks() - d->frameTime;
+    d->frameTextDrawCalls = numDrawCalls_Text() - startDrawCalls;
     SDL_RenderPresent(d->render);
 }
 
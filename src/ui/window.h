@@ -92,6 +92,8 @@ struct Impl_Window {
     float         displayScale; /* DPI-based scaling factor of current display, affects uiScale only */
     float         uiScale;
     uint32_t      frameTime;
+    uint32_t      frameDrawTime;      /* milliseconds spent drawing the latest frame */
+    size_t        frameTextDrawCalls; /* glyph draw calls in the latest frame */
     double        presentTime;
     SDL_Texture * appIcon;
     SDL_Texture * borderShadow;
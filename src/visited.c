@@ -24,13 +24,41 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h"
 
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/hash.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
-#include <the_Foundation/sortedarray.h>
+#include <the_Foundation/thread.h>
+
+#include <stdio.h>
 
 const int maxAge_Visited = 2 * 3600 * 24 * 30; /* two months */
 
+/* The visited URLs are stored as a snapshot plus a journal of changes made after the
+   snapshot was written. Each change appends one record to the journal. When the journal has
+   grown long enough, a new snapshot is written in the background and the journal restarts. */
+static const char *snapshotFileName_Visited_   = "visited.3.lgr";
+static const char *journalFileName_Visited_    = "visited.3.log";
+static const char *oldJournalFileName_Visited_ = "visited.3.log.old"; /* during compaction */
+static const char *legacyFileName_Visited_     = "visited.2.txt";
+static const char *magicSnapshot_Visited_      = "lgrv";
+static const char *magicJournal_Visited_       = "lgrj";
+
+enum iVisitedFileVersion {
+    initial_VisitedFileVersion = 0,
+    /* meta */
+    latest_VisitedFileVersion = initial_VisitedFileVersion,
+};
+
+enum iVisitedRecordType {
+    visit_VisitedRecordType,
+    remove_VisitedRecordType,
+    clear_VisitedRecordType,
+};
+
+static const size_t minCompactRecords_Visited_ = 4096;
+
 void init_VisitedUrl(iVisitedUrl *d) {
     initCurrent_Time(&d->when);
     init_String(&d->url);
@@ -41,65 +69,412 @@ void deinit_VisitedUrl(iVisitedUrl *d) {
     deinit_String(&d->url);
 }
 
-static int cmpUrl_VisitedUrl_(const void *a, const void *b) {
-    return cmpString_String(&((const iVisitedUrl *) a)->url, &((const iVisitedUrl *) b)->url);
+static iHashKey urlKey_(const iString *url) {
+    return crc32_Block(&url->chars);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(VisitedNode)
+
+struct Impl_VisitedNode {
+    iHashNode     node; /* key is a hash of the URL */
+    iVisitedUrl   visit;
+    iVisitedNode *sameKey; /* other URLs whose hash collides */
+    iVisitedNode *older;
+    iVisitedNode *newer;
+};
+
+static iVisitedNode *new_VisitedNode_(iRangecc url, iTime when, uint16_t flags) {
+    iVisitedNode *d = iMalloc(VisitedNode);
+    initRange_String(&d->visit.url, url);
+    d->visit.when  = when;
+    d->visit.flags = flags;
+    d->node.key    = urlKey_(&d->visit.url);
+    d->sameKey     = NULL;
+    d->older       = NULL;
+    d->newer       = NULL;
+    return d;
+}
+
+static void delete_VisitedNode_(iVisitedNode *d) {
+    deinit_VisitedUrl(&d->visit);
+    free(d);
+}
+
+static int cmpWhen_VisitedNodePtr_(const void *a, const void *b) {
+    const iVisitedNode *s = *(const void **) a, *t = *(const void **) b;
+    return cmp_Time(&s->visit.when, &t->visit.when);
 }
 
-static int cmpNewer_VisitedUrl_(const void *insert, const void *existing) {
-    return seconds_Time(&((const iVisitedUrl *) insert  )->when) >
-           seconds_Time(&((const iVisitedUrl *) existing)->when);
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(VisitedSnapshot)
+
+struct Impl_VisitedSnapshot {
+    iString dir;
+    iArray  items; /* VisitedUrl, oldest first */
+};
+
+static iVisitedSnapshot *new_VisitedSnapshot_(const iString *dir) {
+    iVisitedSnapshot *d = iMalloc(VisitedSnapshot);
+    initCopy_String(&d->dir, dir);
+    init_Array(&d->items, sizeof(iVisitedUrl));
+    return d;
+}
+
+static void delete_VisitedSnapshot_(iVisitedSnapshot *d) {
+    iForEach(Array, i, &d->items) {
+        deinit_VisitedUrl(i.value);
+    }
+    deinit_Array(&d->items);
+    deinit_String(&d->dir);
+    free(d);
+}
+
+static iBool write_VisitedSnapshot_(const iVisitedSnapshot *d) {
+    iString *path     = concatCStr_Path(&d->dir, snapshotFileName_Visited_);
+    iString *tempPath = concat_String(path, collectNewCStr_String(".tmp"));
+    iBool    ok       = iFalse;
+    iFile *  f        = new_File(tempPath);
+    if (open_File(f, writeOnly_FileMode)) {
+        iStream *outs = stream_File(f);
+        writeData_File(f, magicSnapshot_Visited_, 4);
+        writeU32_Stream(outs, latest_VisitedFileVersion);
+        writeU32_Stream(outs, size_Array(&d->items));
+        iConstForEach(Array, i, &d->items) {
+            const iVisitedUrl *item = i.value;
+            writeU64_Stream(outs, integralSeconds_Time(&item->when));
+            writeU16_Stream(outs, item->flags);
+            serialize_String(&item->url, outs);
+        }
+        close_File(f);
+        ok = rename(cstr_String(tempPath), cstr_String(path)) == 0;
+    }
+    iRelease(f);
+    if (!ok) {
+        remove(cstr_String(tempPath));
+    }
+    delete_String(tempPath);
+    delete_String(path);
+    return ok;
+}
+
+static iThreadResult compact_VisitedSnapshot_(iThread *thread) {
+    iVisitedSnapshot *d = userData_Thread(thread);
+    if (write_VisitedSnapshot_(d)) {
+        /* The snapshot now includes everything that was in the old journal. */
+        iString *oldPath = concatCStr_Path(&d->dir, oldJournalFileName_Visited_);
+        remove(cstr_String(oldPath));
+        delete_String(oldPath);
+    }
+    delete_VisitedSnapshot_(d);
+    return 0;
 }
 
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_Visited {
-    iMutex *mtx;
-    iSortedArray visited;
+    iMutex *      mtx;
+    iHash         urls; /* VisitedNode; colliding hashes are chained via `sameKey` */
+    size_t        count;
+    iVisitedNode *oldest; /* time order for listing and saving */
+    iVisitedNode *newest;
+    iString       dir;
+    iFile *       journal; /* open after loading */
+    size_t        journalCount; /* number of records in the journal */
+    iThread *     compactor;
 };
 
 iDefineTypeConstruction(Visited)
 
+static void clearEntries_Visited_(iVisited *d) {
+    for (iVisitedNode *node = d->oldest, *next; node; node = next) {
+        next = node->newer;
+        delete_VisitedNode_(node);
+    }
+    clear_Hash(&d->urls);
+    d->count  = 0;
+    d->oldest = d->newest = NULL;
+}
+
 void init_Visited(iVisited *d) {
     d->mtx = new_Mutex();
-    init_SortedArray(&d->visited, sizeof(iVisitedUrl), cmpUrl_VisitedUrl_);
+    init_Hash(&d->urls);
+    d->count        = 0;
+    d->oldest       = NULL;
+    d->newest       = NULL;
+    init_String(&d->dir);
+    d->journal      = NULL;
+    d->journalCount = 0;
+    d->compactor    = NULL;
 }
 
 void deinit_Visited(iVisited *d) {
-    iGuardMutex(d->mtx, {
-        clear_Visited(d);
-        deinit_SortedArray(&d->visited);
-    });
+    if (d->compactor) {
+        join_Thread(d->compactor);
+        iRelease(d->compactor);
+    }
+    iRelease(d->journal);
+    clearEntries_Visited_(d);
+    deinit_Hash(&d->urls);
+    deinit_String(&d->dir);
     delete_Mutex(d->mtx);
 }
 
-void save_Visited(const iVisited *d, const char *dirPath) {
-    iString *line = new_String();
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *item = i.value;
-            format_String(line,
-                          "%llu %04x %s\n",
-                          (unsigned long long) integralSeconds_Time(&item->when),
-                          item->flags,
-                          cstr_String(&item->url));
-            writeData_File(f, cstr_String(line), size_String(line));
+static const char *path_Visited_(const iVisited *d, const char *fileName) {
+    return concatPath_CStr(cstr_String(&d->dir), fileName);
+}
+
+static iVisitedNode *find_Visited_(const iVisited *d, const iString *url, iHashKey key) {
+    for (iVisitedNode *node = (iVisitedNode *) value_Hash(&d->urls, key); node;
+         node = node->sameKey) {
+        if (equal_String(&node->visit.url, url)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void link_Visited_(iVisited *d, iVisitedNode *node) {
+    /* Becomes the newest entry. */
+    node->older = d->newest;
+    node->newer = NULL;
+    if (d->newest) {
+        d->newest->newer = node;
+    }
+    else {
+        d->oldest = node;
+    }
+    d->newest = node;
+}
+
+static void unlink_Visited_(iVisited *d, iVisitedNode *node) {
+    if (node->older) {
+        node->older->newer = node->newer;
+    }
+    else {
+        d->oldest = node->newer;
+    }
+    if (node->newer) {
+        node->newer->older = node->older;
+    }
+    else {
+        d->newest = node->older;
+    }
+    node->older = node->newer = NULL;
+}
+
+static void insert_Visited_(iVisited *d, iVisitedNode *node) {
+    iVisitedNode *first = (iVisitedNode *) value_Hash(&d->urls, node->node.key);
+    if (first) {
+        node->sameKey  = first->sameKey;
+        first->sameKey = node;
+    }
+    else {
+        insert_Hash(&d->urls, &node->node);
+    }
+    d->count++;
+}
+
+static void remove_Visited_(iVisited *d, iVisitedNode *node) {
+    iVisitedNode *first = (iVisitedNode *) value_Hash(&d->urls, node->node.key);
+    if (first == node) {
+        remove_Hash(&d->urls, node->node.key);
+        if (node->sameKey) {
+            insert_Hash(&d->urls, &node->sameKey->node);
+        }
+    }
+    else {
+        for (iVisitedNode *prev = first; prev; prev = prev->sameKey) {
+            if (prev->sameKey == node) {
+                prev->sameKey = node->sameKey;
+                break;
+            }
+        }
+    }
+    unlink_Visited_(d, node);
+    d->count--;
+}
+
+static void writeRecord_Visited_(iStream *outs, enum iVisitedRecordType type, const iTime *when,
+                                 uint16_t flags, const iString *url) {
+    writeU8_Stream(outs, type);
+    writeU64_Stream(outs, integralSeconds_Time(when));
+    writeU16_Stream(outs, flags);
+    serialize_String(url, outs);
+}
+
+static void openJournal_Visited_(iVisited *d, iBool isNew) {
+    iRelease(d->journal);
+    d->journal = newCStr_File(path_Visited_(d, journalFileName_Visited_));
+    if (!open_File(d->journal, isNew ? writeOnly_FileMode : append_FileMode)) {
+        iReleasePtr(&d->journal);
+        return;
+    }
+    if (isNew) {
+        writeData_File(d->journal, magicJournal_Visited_, 4);
+        writeU32_File(d->journal, latest_VisitedFileVersion);
+        d->journalCount = 0;
+    }
+}
+
+static void takeSnapshot_Visited_(const iVisited *d, iVisitedSnapshot *snap) {
+    resize_Array(&snap->items, d->count);
+    iVisitedUrl *item = data_Array(&snap->items);
+    for (const iVisitedNode *node = d->oldest; node; node = node->newer, item++) {
+        initCopy_String(&item->url, &node->visit.url); /* shares the data */
+        item->when  = node->visit.when;
+        item->flags = node->visit.flags;
+    }
+}
+
+static void compact_Visited_(iVisited *d) {
+    if (d->compactor) {
+        join_Thread(d->compactor);
+        iReleasePtr(&d->compactor);
+    }
+    iVisitedSnapshot *snap = new_VisitedSnapshot_(&d->dir);
+    takeSnapshot_Visited_(d, snap);
+    if (fileExistsCStr_FileInfo(path_Visited_(d, oldJournalFileName_Visited_))) {
+        /* A previous compaction did not finish, so the old journal is still needed. Everything
+           is in memory, though, so a new snapshot makes both journals unnecessary. */
+        if (write_VisitedSnapshot_(snap)) {
+            remove(path_Visited_(d, oldJournalFileName_Visited_));
+            openJournal_Visited_(d, iTrue);
+        }
+        else {
+            d->journalCount = 0; /* try again later */
+        }
+        delete_VisitedSnapshot_(snap);
+        return;
+    }
+    iReleasePtr(&d->journal);
+    rename(path_Visited_(d, journalFileName_Visited_),
+           path_Visited_(d, oldJournalFileName_Visited_));
+    openJournal_Visited_(d, iTrue);
+    d->compactor = new_Thread(compact_VisitedSnapshot_);
+    setUserData_Thread(d->compactor, snap);
+    start_Thread(d->compactor);
+}
+
+static void append_Visited_(iVisited *d, enum iVisitedRecordType type, const iTime *when,
+                            uint16_t flags, const iString *url) {
+    if (!d->journal) {
+        return; /* not loaded */
+    }
+    writeRecord_Visited_(stream_File(d->journal), type, when, flags, url);
+    flush_Stream(stream_File(d->journal));
+    if (++d->journalCount > iMax(minCompactRecords_Visited_, d->count / 2)) {
+        compact_Visited_(d);
+    }
+}
+
+/* Applies a loaded change. The time order is set up after everything has been loaded. */
+static void apply_Visited_(iVisited *d, enum iVisitedRecordType type, iTime when,
+                           uint16_t flags, iRangecc url) {
+    if (type == clear_VisitedRecordType) {
+        iPtrArray *older = new_PtrArray();
+        iConstForEach(Hash, i, &d->urls) {
+            for (iVisitedNode *node = (iVisitedNode *) i.value; node; node = node->sameKey) {
+                if (cmp_Time(&node->visit.when, &when) <= 0) {
+                    pushBack_PtrArray(older, node);
+                }
+            }
+        }
+        iForEach(PtrArray, j, older) {
+            remove_Visited_(d, j.ptr);
+            delete_VisitedNode_(j.ptr);
+        }
+        delete_PtrArray(older);
+        return;
+    }
+    iVisitedNode *node = new_VisitedNode_(url, when, flags);
+    iVisitedNode *old  = find_Visited_(d, &node->visit.url, node->node.key);
+    if (type == remove_VisitedRecordType) {
+        /* Only remove the visits that happened before the removal. */
+        if (old && cmp_Time(&old->visit.when, &when) <= 0) {
+            remove_Visited_(d, old);
+            delete_VisitedNode_(old);
+        }
+        delete_VisitedNode_(node);
+        return;
+    }
+    if (old) {
+        /* Duplicate; keep the latest visit. */
+        if (cmp_Time(&when, &old->visit.when) >= 0) {
+            old->visit.when  = when;
+            old->visit.flags = flags;
+        }
+        delete_VisitedNode_(node);
+        return;
+    }
+    insert_Visited_(d, node);
+}
+
+static iBool loadSnapshot_Visited_(iVisited *d) {
+    iBool ok = iFalse;
+    iFile *f = newCStr_File(path_Visited_(d, snapshotFileName_Visited_));
+    if (open_File(f, readOnly_FileMode)) {
+        char magic[4];
+        readData_File(f, 4, magic);
+        if (!memcmp(magic, magicSnapshot_Visited_, 4) &&
+            readU32_File(f) <= latest_VisitedFileVersion) {
+            iStream *ins = stream_File(f);
+            iString  url;
+            init_String(&url);
+            for (uint32_t count = readU32_Stream(ins); count > 0 && !atEnd_File(f); count--) {
+                const iTime when = { .ts = { .tv_sec = readU64_Stream(ins) } };
+                const uint16_t flags = readU16_Stream(ins);
+                deserialize_String(&url, ins);
+                apply_Visited_(d, visit_VisitedRecordType, when, flags, range_String(&url));
+            }
+            deinit_String(&url);
+            ok = iTrue;
         }
-        unlock_Mutex(d->mtx);
     }
     iRelease(f);
-    delete_String(line);
+    return ok;
 }
 
-void load_Visited(iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
+static iBool loadJournal_Visited_(iVisited *d, const char *fileName, iBool *isTorn_out) {
+    iBool ok = iFalse;
+    *isTorn_out = iFalse;
+    iFile *f = newCStr_File(path_Visited_(d, fileName));
+    if (open_File(f, readOnly_FileMode)) {
+        char magic[4];
+        readData_File(f, 4, magic);
+        if (!memcmp(magic, magicJournal_Visited_, 4) &&
+            readU32_File(f) <= latest_VisitedFileVersion) {
+            iStream *ins = stream_File(f);
+            iString  url;
+            init_String(&url);
+            while (!atEnd_File(f)) {
+                const uint8_t type = readU8_Stream(ins);
+                const iTime when = { .ts = { .tv_sec = readU64_Stream(ins) } };
+                const uint16_t flags = readU16_Stream(ins);
+                deserialize_String(&url, ins);
+                if (type > clear_VisitedRecordType || when.ts.tv_sec == 0 ||
+                    (type != clear_VisitedRecordType && isEmpty_String(&url))) {
+                    *isTorn_out = iTrue; /* incomplete write */
+                    break;
+                }
+                apply_Visited_(d, type, when, flags, range_String(&url));
+                d->journalCount++;
+            }
+            deinit_String(&url);
+            ok = iTrue;
+        }
+    }
+    iRelease(f);
+    return ok;
+}
+
+static void loadLegacy_Visited_(iVisited *d) {
+    iFile *f = newCStr_File(path_Visited_(d, legacyFileName_Visited_));
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
         const iRangecc src  = range_Block(collect_Block(readAll_File(f)));
         iRangecc       line = iNullRange;
-        iTime          now;
-        initCurrent_Time(&now);
         while (nextSplit_Rangecc(src, "\n", &line)) {
             if (size_Range(&line) < 8) continue;
             char *endp = NULL;
@@ -107,88 +482,127 @@ void load_Visited(iVisited *d, const char *dirPath) {
             if (ts == 0) break;
             const uint32_t flags = strtoul(skipSpace_CStr(endp), &endp, 16);
             const char *urlStart = skipSpace_CStr(endp);
-            iVisitedUrl item;
-            item.when.ts = (struct timespec){ .tv_sec = ts };
-            if (secondsSince_Time(&now, &item.when) > maxAge_Visited) {
-                continue; /* Too old. */
-            }
-            item.flags = flags;
-            initRange_String(&item.url, (iRangecc){ urlStart, line.end });
-            insert_SortedArray(&d->visited, &item);
+            apply_Visited_(d,
+                           visit_VisitedRecordType,
+                           (iTime){ .ts = { .tv_sec = ts } },
+                           flags,
+                           (iRangecc){ urlStart, line.end });
         }
-        unlock_Mutex(d->mtx);
     }
     iRelease(f);
 }
 
-void clear_Visited(iVisited *d) {
+static void updateOrder_Visited_(iVisited *d) {
+    iPtrArray *nodes = new_PtrArray();
+    iTime      now;
+    initCurrent_Time(&now);
+    iConstForEach(Hash, i, &d->urls) {
+        for (iVisitedNode *node = (iVisitedNode *) i.value; node; node = node->sameKey) {
+            pushBack_PtrArray(nodes, node);
+        }
+    }
+    /* Link the time order in one go. */
+    sort_Array(nodes, cmpWhen_VisitedNodePtr_);
+    d->oldest = d->newest = NULL;
+    iForEach(PtrArray, j, nodes) {
+        iVisitedNode *node = j.ptr;
+        if (secondsSince_Time(&now, &node->visit.when) > maxAge_Visited) {
+            remove_Visited_(d, node); /* too old */
+            delete_VisitedNode_(node);
+            continue;
+        }
+        link_Visited_(d, node);
+    }
+    delete_PtrArray(nodes);
+}
+
+void save_Visited(const iVisited *d, const char *dirPath) {
+    iUnused(dirPath); /* same as when loaded */
     lock_Mutex(d->mtx);
-    iForEach(Array, v, &d->visited.values) {
-        deinit_VisitedUrl(v.value);
+    if (d->journal) {
+        flush_Stream(stream_File(d->journal));
     }
-    clear_SortedArray(&d->visited);
     unlock_Mutex(d->mtx);
 }
 
-static size_t find_Visited_(const iVisited *d, const iString *url) {
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    set_String(&visit.url, url);
-    size_t pos = iInvalidPos;
-    iGuardMutex(d->mtx, {
-        locate_SortedArray(&d->visited, &visit, &pos);
-        deinit_VisitedUrl(&visit);
-    });
-    return pos;
+void load_Visited(iVisited *d, const char *dirPath) {
+    lock_Mutex(d->mtx);
+    setCStr_String(&d->dir, dirPath);
+    const iBool hasSnapshot = loadSnapshot_Visited_(d);
+    if (!hasSnapshot) {
+        loadLegacy_Visited_(d);
+    }
+    d->journalCount = 0;
+    iBool isOldTorn, isTorn;
+    const iBool hasOldJournal = loadJournal_Visited_(d, oldJournalFileName_Visited_, &isOldTorn);
+    const iBool hasJournal    = loadJournal_Visited_(d, journalFileName_Visited_, &isTorn);
+    updateOrder_Visited_(d);
+    openJournal_Visited_(d, !hasJournal);
+    /* Records appended after a torn one could not be read back, so the journal is
+       replaced with a snapshot right away. */
+    if (!hasSnapshot || hasOldJournal || isTorn) {
+        compact_Visited_(d);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+void clear_Visited(iVisited *d) {
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    clearEntries_Visited_(d);
+    append_Visited_(d, clear_VisitedRecordType, &now, 0, collectNew_String());
+    unlock_Mutex(d->mtx);
 }
 
 void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
     if (isEmpty_String(url)) return;
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    visit.flags = visitFlags;
-    set_String(&visit.url, url);
-    size_t pos;
+    const iHashKey key = urlKey_(url);
+    iTime now;
+    initCurrent_Time(&now);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &visit, &pos)) {
-        iVisitedUrl *old = at_SortedArray(&d->visited, pos);
-        if (cmpNewer_VisitedUrl_(&visit, old)) {
-            old->when = visit.when;
-            old->flags = visitFlags;
-            unlock_Mutex(d->mtx);
-            deinit_VisitedUrl(&visit);
-            return;
+    iVisitedNode *node = find_Visited_(d, url, key);
+    if (node) {
+        if (cmp_Time(&now, &node->visit.when) >= 0) {
+            node->visit.when  = now;
+            node->visit.flags = visitFlags;
         }
+        unlink_Visited_(d, node);
     }
-    insert_SortedArray(&d->visited, &visit);
+    else {
+        node = new_VisitedNode_(range_String(url), now, visitFlags);
+        insert_Visited_(d, node);
+    }
+    link_Visited_(d, node);
+    append_Visited_(d, visit_VisitedRecordType, &node->visit.when, node->visit.flags, url);
     unlock_Mutex(d->mtx);
 }
 
 void removeUrl_Visited(iVisited *d, const iString *url) {
-    iGuardMutex(d->mtx, {
-        size_t pos = find_Visited_(d, url);
-        if (pos < size_SortedArray(&d->visited)) {
-            iVisitedUrl *visUrl = at_SortedArray(&d->visited, pos);
-            if (equal_String(&visUrl->url, url)) {
-                deinit_VisitedUrl(visUrl);
-                remove_Array(&d->visited.values, pos);
-            }
-        }
-    });
+    const iHashKey key = urlKey_(url);
+    lock_Mutex(d->mtx);
+    iVisitedNode *node = find_Visited_(d, url, key);
+    if (node) {
+        iTime now;
+        initCurrent_Time(&now);
+        remove_Visited_(d, node);
+        delete_VisitedNode_(node);
+        append_Visited_(d, remove_VisitedRecordType, &now, 0, url);
+    }
+    unlock_Mutex(d->mtx);
 }
 
 iTime urlVisitTime_Visited(const iVisited *d, const iString *url) {
-    iVisitedUrl item;
-    size_t pos;
-    iZap(item);
-    initCopy_String(&item.url, url);
+    const iHashKey key = urlKey_(url); /* outside the lock */
+    iTime when;
+    iZap(when);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &item, &pos)) {
-        item.when = ((const iVisitedUrl *) constAt_SortedArray(&d->visited, pos))->when;
+    const iVisitedNode *node = find_Visited_(d, url, key);
+    if (node) {
+        when = node->visit.when;
     }
     unlock_Mutex(d->mtx);
-    deinit_String(&item.url);
-    return item.when;
+    return when;
 }
 
 iBool containsUrl_Visited(const iVisited *d, const iString *url) {
@@ -196,24 +610,17 @@ iBool containsUrl_Visited(const iVisited *d, const iString *url) {
     return isValid_Time(&time);
 }
 
-static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
-    const iVisitedUrl *s = *(const void **) a, *t = *(const void **) b;
-    return -cmp_Time(&s->when, &t->when);
-}
-
 const iArray *list_Visited(const iVisited *d, size_t count) {
     iPtrArray *urls = collectNew_PtrArray();
     iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
-            if (~vis->flags & transient_VisitedUrlFlag) {
-                pushBack_PtrArray(urls, vis);
+        for (const iVisitedNode *node = d->newest; node; node = node->older) {
+            if (~node->visit.flags & transient_VisitedUrlFlag) {
+                pushBack_PtrArray(urls, &node->visit);
+                if (count > 0 && size_PtrArray(urls) == count) {
+                    break;
+                }
             }
         }
     });
-    sort_Array(urls, cmpWhenDescending_VisitedUrlPtr_);
-    if (count > 0 && size_Array(urls) > count) {
-        resize_Array(urls, count);
-    }
     return urls;
 }